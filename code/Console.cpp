@@ -4,6 +4,7 @@
 #include "MesaMain.h"
 #include "GUI.H"
 #include "Input.h"
+#include "ProjectData.h"
 
 
 #define MESSAGES_CHAR_CAPACITY 4000
@@ -165,6 +166,7 @@ void SetupConsoleCommands()
     sNoclipConsole.bind_cmd("editor", StartEditor);
     sNoclipConsole.bind_cmd("play", StartGameSpace);
     sNoclipConsole.bind_cmd("elephant", ElephantJPG);
+    sNoclipConsole.bind_cmd("testatlaspacker", TestPackAtlasRects);
 
     PrintLog.Message("Boot menu initialized...");
 }
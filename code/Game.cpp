@@ -30,6 +30,7 @@ void TemporaryGameLoop()
     PipLangVM_RunGameFunction("tick");
 //    PipLangVM_RunGameFunction("posttick");
 //    PipLangVM_RunGameFunction("draw");
+    PipLangVM_CollectCycles(0.5f);
     ReadBackGfxValues();
 }
 
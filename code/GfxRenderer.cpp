@@ -52,8 +52,10 @@ namespace Gfx
             "// Input attributes\n"
             "layout (location = 0) in vec2 vs_pos;\n"
             "layout (location = 1) in vec2 vs_uv;\n"
+            "layout (location = 2) in vec4 vs_tint;\n"
             "// Passed to fragment shader\n"
             "out vec2 fs_uv;\n"
+            "out vec4 fs_tint;\n"
             "// Application data\n"
             "uniform mat3 model;\n"
             "uniform mat3 view;\n"
@@ -61,6 +63,7 @@ namespace Gfx
             "void main()\n"
             "{\n"
             "    fs_uv = vs_uv;\n"
+            "    fs_tint = vs_tint;\n"
             "    vec3 pos = projection * view * model * vec3(vs_pos, 1.0);\n"
             "    gl_Position = vec4(pos.xy, 0.0, 1.0);\n"
             "}\n";
@@ -69,6 +72,7 @@ namespace Gfx
             "#version 330\n"
             "// From vertex shader\n"
             "in vec2 fs_uv;\n"
+            "in vec4 fs_tint;\n"
             "// Application data\n"
             "uniform sampler2D sampler0;\n"
             "uniform vec3 fragmentColor;\n"
@@ -76,7 +80,7 @@ namespace Gfx
             "layout (location = 0) out vec4 color;\n"
             "void main()\n"
             "{\n"
-            "    color = vec4(fragmentColor, 1.0) * texture(sampler0, fs_uv);\n"
+            "    color = vec4(fragmentColor, 1.0) * fs_tint * texture(sampler0, fs_uv);\n"
             "}\n";
 
     static const char *__primitive_shader_vs =
@@ -108,16 +112,98 @@ namespace Gfx
     static bool gameClearFlag = false;
     static vec4 gameClearColor = vec4();
     static std::vector<float> gameLayer_PrimitiveVB;
+    GameLayerFrameStats gameLayerFrameStats;
+
+    // Sprite batching: every queued sprite is written as a quad (SpriteVertex, already in world space) into
+    // one streaming VBO that keeps its size between frames and is orphaned + refilled each frame. Quad
+    // indices never change so they live in a static IBO sized to the VBO capacity. Consecutive
+    // sprites with the same texture are drawn with one glDrawElements. Sprites aren't reordered across
+    // textures so overlapping sprites still draw in the order they were queued; project sprites are packed
+    // into a few atlas pages (CompileRuntimeTextureAtlas) so most frames are one run anyway.
+    static u32 spriteBatchVAO = 0;
+    static u32 spriteBatchVBO = 0;
+    static u32 spriteBatchIBO = 0;
+    struct SpriteVertex
+    {
+        float x, y, u, v;
+        u32 tint; // RenderQueueData::tint, read as normalized r g b a bytes
+    };
+    static u32 spriteBatchCapacity = 0; // in quads
+    static std::vector<SpriteVertex> spriteBatchVertices;
+
+    static void EnsureSpriteBatchCapacity(u32 quadCount)
+    {
+        if (!spriteBatchVAO)
+        {
+            glGenVertexArrays(1, &spriteBatchVAO);
+            glBindVertexArray(spriteBatchVAO);
+
+            glGenBuffers(1, &spriteBatchVBO);
+            glBindBuffer(GL_ARRAY_BUFFER, spriteBatchVBO);
+            glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(SpriteVertex), (void *) offsetof(SpriteVertex, x));
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(SpriteVertex), (void *) offsetof(SpriteVertex, u));
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(SpriteVertex), (void *) offsetof(SpriteVertex, tint));
+            glEnableVertexAttribArray(2);
+
+            glGenBuffers(1, &spriteBatchIBO);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, spriteBatchIBO);
+        }
+
+        if (quadCount <= spriteBatchCapacity) return;
+
+        u32 newCapacity = spriteBatchCapacity < 256 ? 256 : spriteBatchCapacity;
+        while (newCapacity < quadCount) newCapacity *= 2;
+
+        std::vector<u32> indices(newCapacity * 6);
+        for (u32 q = 0; q < newCapacity; ++q)
+        {
+            indices[q * 6 + 0] = q * 4 + 0;
+            indices[q * 6 + 1] = q * 4 + 2;
+            indices[q * 6 + 2] = q * 4 + 1;
+            indices[q * 6 + 3] = q * 4 + 2;
+            indices[q * 6 + 4] = q * 4 + 3;
+            indices[q * 6 + 5] = q * 4 + 1;
+        }
+
+        glBindVertexArray(spriteBatchVAO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, spriteBatchIBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(u32) * indices.size(), indices.data(), GL_STATIC_DRAW);
+        gameLayerFrameStats.bytesUploaded += (u32)(sizeof(u32) * indices.size());
+
+        spriteBatchCapacity = newCapacity;
+        spriteBatchVertices.reserve(newCapacity * 4);
+    }
 
     void QueueSpriteForRender(i64 spriteId, vec2 position)
     {
         RenderQueueData dat;
-        Gfx::TextureHandle texHandle = MapIntoTextureAtlas(&runtimeTextureAtlas, spriteId);
-        dat.sprite = texHandle;
+        dat.sprite = MapIntoTextureAtlas(&runtimeTextureAtlas, spriteId);
         dat.position = position;
+        dat.tint = 0xffffffff;
+        dat.flip = 0;
         gameRenderQueue.push_back(dat);
     }
 
+    void QueueSpriteBatchForRender(i64 spriteId, const float *xs, const float *ys, int stride, int count, u32 tint, u8 flip)
+    {
+        if (count <= 0) return;
+
+        RenderQueueData dat;
+        dat.sprite = MapIntoTextureAtlas(&runtimeTextureAtlas, spriteId);
+        dat.tint = tint;
+        dat.flip = flip;
+
+        size_t first = gameRenderQueue.size();
+        gameRenderQueue.resize(first + count, dat);
+        RenderQueueData *out = gameRenderQueue.data() + first;
+        for (int i = 0; i < count; ++i)
+        {
+            out[i].position = vec2(xs[i * stride], ys[i * stride]);
+        }
+    }
+
     void SetGameLayerClearColor(vec4 color)
     {
         gameClearFlag = true;
@@ -192,6 +278,15 @@ namespace Gfx
         GLCreateShaderProgram(spriteShader, __sprite_shader_vs, __sprite_shader_fs);
         GLCreateShaderProgram(primitiveShader, __primitive_shader_vs, __primitive_shader_fs);
 
+        spriteShaderUniforms.projection = GLGetUniformHandle(spriteShader, "projection");
+        spriteShaderUniforms.view = GLGetUniformHandle(spriteShader, "view");
+        spriteShaderUniforms.model = GLGetUniformHandle(spriteShader, "model");
+        spriteShaderUniforms.sampler0 = GLGetUniformHandle(spriteShader, "sampler0");
+        spriteShaderUniforms.fragmentColor = GLGetUniformHandle(spriteShader, "fragmentColor");
+        primitiveShaderUniforms.projection = GLGetUniformHandle(primitiveShader, "projection");
+        primitiveShaderUniforms.view = GLGetUniformHandle(primitiveShader, "view");
+        primitiveShaderUniforms.model = GLGetUniformHandle(primitiveShader, "model");
+
         CreateMiscellaneous();
 
         UpdateBackBufferAndGUILayerSizeToMatchWindowSizeIntegerScaled();
@@ -356,105 +451,80 @@ namespace Gfx
         viewMatrix[2][0] = (float)-gameCamera0Position.x;
         viewMatrix[2][1] = (float)-gameCamera0Position.y;
 
-        GLBindMatrix3fv(spriteShader, "projection", 1, projectionMatrix.ptr());
-        GLBindMatrix3fv(spriteShader, "view", 1, viewMatrix.ptr());
+        GLBindMatrix3fv(spriteShaderUniforms.projection, 1, projectionMatrix.ptr());
+        GLBindMatrix3fv(spriteShaderUniforms.view, 1, viewMatrix.ptr());
 
         static TextureHandle mushroom = CreateGPUTextureFromDisk(data_path("mushroom.png").c_str());
 
-        const i32 numQuads = 1;
-        const u32 verticesCount = 16 * numQuads;
-        const u32 indicesCount = 6 * numQuads;
-        float vb[verticesCount];
-        u32 ib[indicesCount];
-
-        // pass VBO (x, y, u, v) and IBO to shader
-        static u32 spriteBatchVAO = 0;
-        static u32 spriteBatchVBO = 0;
-        static u32 spriteBatchIBO = 0;
-        if (!spriteBatchVAO)
-        {
-            glGenVertexArrays(1, &spriteBatchVAO);
-            glBindVertexArray(spriteBatchVAO);
-
-            glGenBuffers(1, &spriteBatchVBO);
-            glBindBuffer(GL_ARRAY_BUFFER, spriteBatchVBO);
-            glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 16, nullptr, GL_DYNAMIC_DRAW);
-            glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 4, nullptr);
-            glEnableVertexAttribArray(0);
-            glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 4,
-                                  (void *) (sizeof(float) * 2)); // i really feel like this can be nullptr
-            glEnableVertexAttribArray(1);
-
-            glGenBuffers(1, &spriteBatchIBO);
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, spriteBatchIBO);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(u32) * 6, nullptr, GL_DYNAMIC_DRAW);
-        }
+        gameLayerFrameStats = GameLayerFrameStats();
 
         mat3 modelMatrix = mat3();
+        GLBindMatrix3fv(spriteShaderUniforms.model, 1, modelMatrix.ptr());
+        GLBind1i(spriteShaderUniforms.sampler0, 0);
+        GLBind3f(spriteShaderUniforms.fragmentColor, 1.f, 1.f, 1.f);
+        glActiveTexture(GL_TEXTURE0);
 
-        for (RenderQueueData renderData : gameRenderQueue)
+        const u32 quadCount = (u32)gameRenderQueue.size();
+        if (quadCount > 0)
         {
-            float sprw = (float) renderData.sprite.width;
-            float sprh = (float) renderData.sprite.height;
-            int sprtexid = renderData.sprite.textureId;
-            if (sprtexid == 0) sprtexid = mushroom.textureId;
-
-            vb[0] = 0;
-            vb[1] = 0;
-            vb[2] = 0;
-            vb[3] = 1;
-
-            vb[4] = sprw;
-            vb[5] = 0;
-            vb[6] = 1;
-            vb[7] = 1;
-
-            vb[8] = 0;
-            vb[9] = sprh;
-            vb[10] = 0;
-            vb[11] = 0;
-
-            vb[12] = sprw;
-            vb[13] = sprh;
-            vb[14] = 1;
-            vb[15] = 0;
-
-            ib[0] = 0;
-            ib[1] = 2;
-            ib[2] = 1;
-            ib[3] = 2;
-            ib[4] = 3;
-            ib[5] = 1;
-
-            modelMatrix[2][0] = renderData.position.x;
-            modelMatrix[2][1] = renderData.position.y;
-
-            GLBindMatrix3fv(spriteShader, "model", 1, modelMatrix.ptr());
-
+            EnsureSpriteBatchCapacity(quadCount);
+
+            spriteBatchVertices.clear();
+            for (const RenderQueueData& renderData : gameRenderQueue)
+            {
+                float x0 = renderData.position.x;
+                float y0 = renderData.position.y;
+                float x1 = x0 + (float) renderData.sprite.width;
+                float y1 = y0 + (float) renderData.sprite.height;
+                // sprite images are stored bottom row first so the top of the quad samples uvMax.y
+                float uLeft = renderData.sprite.uvMin.x;
+                float uRight = renderData.sprite.uvMax.x;
+                float vTop = renderData.sprite.uvMax.y;
+                float vBottom = renderData.sprite.uvMin.y;
+                if (renderData.flip & SPRITE_FLIP_X) std::swap(uLeft, uRight);
+                if (renderData.flip & SPRITE_FLIP_Y) std::swap(vTop, vBottom);
+                u32 tint = renderData.tint;
+                SpriteVertex quad[4] = {
+                    { x0, y0, uLeft, vTop, tint },
+                    { x1, y0, uRight, vTop, tint },
+                    { x0, y1, uLeft, vBottom, tint },
+                    { x1, y1, uRight, vBottom, tint }
+                };
+                spriteBatchVertices.insert(spriteBatchVertices.end(), quad, quad + 4);
+            }
+
+            const u32 vertexBytes = (u32)(sizeof(SpriteVertex) * spriteBatchVertices.size());
             glBindVertexArray(spriteBatchVAO);
             glBindBuffer(GL_ARRAY_BUFFER, spriteBatchVBO);
-            glBufferData(GL_ARRAY_BUFFER, sizeof(float) * verticesCount, vb, GL_DYNAMIC_DRAW);
-            glBindBuffer(GL_ARRAY_BUFFER, spriteBatchIBO);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(u32) * indicesCount, ib, GL_DYNAMIC_DRAW);
-
-            // set Sampler2D/int sampler0
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, sprtexid);
-            GLBind1i(spriteShader, "sampler0", 0);
-            // set vec3 fragmentColor 
-            GLBind3f(spriteShader, "fragmentColor", 1.f, 1.f, 1.f);
-
-            // draw
-            glDrawElements(GL_TRIANGLES, indicesCount, GL_UNSIGNED_INT, nullptr);
+            // orphan last frame's storage so the driver doesn't have to wait on it, then fill what we use
+            glBufferData(GL_ARRAY_BUFFER, sizeof(SpriteVertex) * 4 * spriteBatchCapacity, nullptr, GL_STREAM_DRAW);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, vertexBytes, spriteBatchVertices.data());
+            gameLayerFrameStats.bytesUploaded += vertexBytes;
+
+            u32 runStart = 0;
+            while (runStart < quadCount)
+            {
+                GLuint texId = gameRenderQueue[runStart].sprite.textureId;
+                u32 runEnd = runStart + 1;
+                while (runEnd < quadCount && gameRenderQueue[runEnd].sprite.textureId == texId) ++runEnd;
+
+                glBindTexture(GL_TEXTURE_2D, texId == 0 ? mushroom.textureId : texId);
+                glDrawElements(GL_TRIANGLES, (GLsizei)(6 * (runEnd - runStart)), GL_UNSIGNED_INT,
+                               (void *) (sizeof(u32) * 6 * runStart));
+                ++gameLayerFrameStats.drawCalls;
+
+                runStart = runEnd;
+            }
+            gameLayerFrameStats.spritesDrawn = quadCount;
         }
 
 
         // PRIMITIVE STUFF
         UseShader(primitiveShader);
-        GLBindMatrix3fv(primitiveShader, "projection", 1, projectionMatrix.ptr());
-        GLBindMatrix3fv(primitiveShader, "view", 1, viewMatrix.ptr());
+        GLBindMatrix3fv(primitiveShaderUniforms.projection, 1, projectionMatrix.ptr());
+        GLBindMatrix3fv(primitiveShaderUniforms.view, 1, viewMatrix.ptr());
         modelMatrix = mat3();
-        GLBindMatrix3fv(primitiveShader, "model", 1, modelMatrix.ptr());
+        GLBindMatrix3fv(primitiveShaderUniforms.model, 1, modelMatrix.ptr());
 
         static u32 prmVAO = 0;
         static u32 prmVBO = 0;
@@ -477,6 +547,8 @@ namespace Gfx
         glBindBuffer(GL_ARRAY_BUFFER, prmVBO);
         glBufferData(GL_ARRAY_BUFFER, (int) sizeof(float) * prmvbsz, gameLayer_PrimitiveVB.data(), GL_DYNAMIC_DRAW);
         glDrawArrays(GL_TRIANGLES, 0, prmvbsz / 6);
+        gameLayerFrameStats.bytesUploaded += (u32)(sizeof(float) * prmvbsz);
+        ++gameLayerFrameStats.drawCalls;
 
         // RESET GAME FRAME RENDER DATA
         gameRenderQueue.clear();
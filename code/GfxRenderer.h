@@ -7,16 +7,36 @@
 
 namespace Gfx
 {
+    enum SpriteFlip : u8
+    {
+        SPRITE_FLIP_X = 1,
+        SPRITE_FLIP_Y = 2
+    };
+
     struct RenderQueueData
     {
-        Gfx::TextureHandle sprite;
+        AtlasSprite sprite;
         vec2 position;
+        u32 tint;   // r | g << 8 | b << 16 | a << 24, multiplies the sprite's texels
+        u8 flip;    // SpriteFlip bits
     };
     void QueueSpriteForRender(i64 spriteId, vec2 position);
+    // count sprites of spriteId at (xs[i * stride], ys[i * stride]), all with the same tint and flip.
+    // The atlas lookup happens once for the whole batch.
+    void QueueSpriteBatchForRender(i64 spriteId, const float *xs, const float *ys, int stride, int count, u32 tint, u8 flip);
     void SetGameLayerClearColor(vec4 color);
     void Primitive_DrawRect(float x, float y, float w, float h, vec4 color);
     extern ivec2 gameCamera0Position;
 
+    // Counters for the last RenderGameLayer call
+    struct GameLayerFrameStats
+    {
+        u32 spritesDrawn = 0;
+        u32 drawCalls = 0;      // sprite batches + primitives
+        u32 bytesUploaded = 0;  // vertex and index data sent to the GPU
+    };
+    extern GameLayerFrameStats gameLayerFrameStats;
+
     enum class PixelPerfectRenderScale
     {
         OneHundredPercent = 1,
@@ -79,6 +99,22 @@ namespace Gfx
         Shader finalPassShader;
         Shader spriteShader;
         Shader primitiveShader;
+
+        struct
+        {
+            UniformHandle projection;
+            UniformHandle view;
+            UniformHandle model;
+            UniformHandle sampler0;
+            UniformHandle fragmentColor;
+        } spriteShaderUniforms;
+
+        struct
+        {
+            UniformHandle projection;
+            UniformHandle view;
+            UniformHandle model;
+        } primitiveShaderUniforms;
     };
 
     // todo remove probably make an extern variable
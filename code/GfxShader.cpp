@@ -353,5 +353,64 @@ namespace Gfx
             warningUniformNotFound(shader, uniformName);
         }
     }
-    
+    UniformHandle GLGetUniformHandle(const Shader& shader, const char* uniformName)
+    {
+        UniformHandle uniform;
+        uniform.location = GetCachedUniformLocation(shader, uniformName);
+        if (uniform.location < 0)
+        {
+            warningUniformNotFound(shader, uniformName);
+        }
+        return uniform;
+    }
+
+    void GLBind1i(UniformHandle uniform, GLint v0)
+    {
+        glUniform1i(uniform.location, v0);
+    }
+
+    void GLBind2i(UniformHandle uniform, GLint v0, GLint v1)
+    {
+        glUniform2i(uniform.location, v0, v1);
+    }
+
+    void GLBind3i(UniformHandle uniform, GLint v0, GLint v1, GLint v2)
+    {
+        glUniform3i(uniform.location, v0, v1, v2);
+    }
+
+    void GLBind4i(UniformHandle uniform, GLint v0, GLint v1, GLint v2, GLint v3)
+    {
+        glUniform4i(uniform.location, v0, v1, v2, v3);
+    }
+
+    void GLBind1f(UniformHandle uniform, GLfloat v0)
+    {
+        glUniform1f(uniform.location, v0);
+    }
+
+    void GLBind2f(UniformHandle uniform, GLfloat v0, GLfloat v1)
+    {
+        glUniform2f(uniform.location, v0, v1);
+    }
+
+    void GLBind3f(UniformHandle uniform, GLfloat v0, GLfloat v1, GLfloat v2)
+    {
+        glUniform3f(uniform.location, v0, v1, v2);
+    }
+
+    void GLBind4f(UniformHandle uniform, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3)
+    {
+        glUniform4f(uniform.location, v0, v1, v2, v3);
+    }
+
+    void GLBindMatrix3fv(UniformHandle uniform, GLsizei count, const GLfloat* value)
+    {
+        glUniformMatrix3fv(uniform.location, count, GL_FALSE, value);
+    }
+
+    void GLBindMatrix4fv(UniformHandle uniform, GLsizei count, const GLfloat* value)
+    {
+        glUniformMatrix4fv(uniform.location, count, GL_FALSE, value);
+    }
 }
@@ -37,4 +37,25 @@ namespace Gfx
     void GLBind4f(const Shader& shader, const char* uniformName, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3);
     void GLBindMatrix3fv(const Shader& shader, const char* uniformName, GLsizei count, const GLfloat* value);
     void GLBindMatrix4fv(const Shader& shader, const char* uniformName, GLsizei count, const GLfloat* value);
+
+    /** Uniform location looked up once after the shader program is created. Binding through a handle is a
+        straight glUniform* call: no std::string, no hashing. An unknown uniform gives location -1 which
+        glUniform* silently ignores, so the warning is printed once here instead of on every bind. */
+    struct UniformHandle
+    {
+        GLint location = -1;
+    };
+
+    UniformHandle GLGetUniformHandle(const Shader& shader, const char* uniformName);
+
+    void GLBind1i(UniformHandle uniform, GLint v0);
+    void GLBind2i(UniformHandle uniform, GLint v0, GLint v1);
+    void GLBind3i(UniformHandle uniform, GLint v0, GLint v1, GLint v2);
+    void GLBind4i(UniformHandle uniform, GLint v0, GLint v1, GLint v2, GLint v3);
+    void GLBind1f(UniformHandle uniform, GLfloat v0);
+    void GLBind2f(UniformHandle uniform, GLfloat v0, GLfloat v1);
+    void GLBind3f(UniformHandle uniform, GLfloat v0, GLfloat v1, GLfloat v2);
+    void GLBind4f(UniformHandle uniform, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3);
+    void GLBindMatrix3fv(UniformHandle uniform, GLsizei count, const GLfloat* value);
+    void GLBindMatrix4fv(UniformHandle uniform, GLsizei count, const GLfloat* value);
 }
@@ -41,3 +41,68 @@ void* MemoryLinearAllocate(MemoryLinearBuffer* buffer, size_t wantedBytes, size_
 
 
 
+#define MEMORY_POOL_ALIGN 16
+
+void MemoryPoolInitialize(MemoryPool* pool, size_t blockSize, size_t blocksPerSlab)
+{
+    *pool = MemoryPool();
+    if (blockSize < sizeof(void*)) blockSize = sizeof(void*);
+    pool->blockSize = (blockSize + MEMORY_POOL_ALIGN - 1) & ~(size_t)(MEMORY_POOL_ALIGN - 1);
+    pool->blocksPerSlab = blocksPerSlab;
+}
+
+void* MemoryPoolAllocate(MemoryPool* pool)
+{
+    if (pool->freeList == nullptr)
+    {
+        // Slab header is padded to MEMORY_POOL_ALIGN so the blocks after it stay aligned
+        u8* slab = (u8*) malloc(MEMORY_POOL_ALIGN + pool->blockSize * pool->blocksPerSlab);
+        if (slab == nullptr)
+        {
+            printf("Out of memory in given MemoryPool");
+            return nullptr;
+        }
+        *(void**)slab = pool->slabs;
+        pool->slabs = slab;
+        ++pool->slabCount;
+
+        // Thread the new blocks onto the free-list so the first block in the slab is handed out first
+        u8* blocks = slab + MEMORY_POOL_ALIGN;
+        for (size_t i = pool->blocksPerSlab; i > 0; --i)
+        {
+            void* block = blocks + (i - 1) * pool->blockSize;
+            *(void**)block = pool->freeList;
+            pool->freeList = block;
+        }
+    }
+
+    void* block = pool->freeList;
+    pool->freeList = *(void**)block;
+    ++pool->liveBlocks;
+    if (pool->liveBlocks > pool->peakLiveBlocks) pool->peakLiveBlocks = pool->liveBlocks;
+    return block;
+}
+
+void MemoryPoolFree(MemoryPool* pool, void* block)
+{
+    ASSERT(pool->liveBlocks > 0);
+    *(void**)block = pool->freeList;
+    pool->freeList = block;
+    --pool->liveBlocks;
+}
+
+void MemoryPoolRelease(MemoryPool* pool)
+{
+    void* slab = pool->slabs;
+    while (slab)
+    {
+        void* previous = *(void**)slab;
+        free(slab);
+        slab = previous;
+    }
+    size_t blockSize = pool->blockSize;
+    size_t blocksPerSlab = pool->blocksPerSlab;
+    *pool = MemoryPool();
+    pool->blockSize = blockSize;
+    pool->blocksPerSlab = blocksPerSlab;
+}
@@ -25,3 +25,31 @@ void MemoryLinearInitialize(MemoryLinearBuffer* buffer, size_t sizeBytes);
 void* MemoryLinearAllocate(MemoryLinearBuffer* buffer, size_t wantedBytes, size_t align = 16);
 
 #define MEMORY_LINEAR_ALLOCATE(buffer, type) MemoryLinearAllocate(buffer, sizeof(type), alignof(type))
+
+
+struct MemoryPool
+{
+    // Pool allocator for fixed size blocks
+    // Blocks are carved out of slabs of blocksPerSlab blocks. Freed blocks go on a free-list and are
+    // handed out again before another slab is allocated. Slabs are only given back in MemoryPoolRelease.
+
+    // The free-list lives inside the free blocks so blockSize is at least sizeof(void*).
+    // The allocator is not thread-safe.
+
+    size_t blockSize = 0;
+    size_t blocksPerSlab = 0;
+    void* freeList = nullptr;
+    void* slabs = nullptr; // each slab starts with a pointer to the previous slab
+
+    size_t slabCount = 0;
+    size_t liveBlocks = 0;
+    size_t peakLiveBlocks = 0;
+};
+
+void MemoryPoolInitialize(MemoryPool* pool, size_t blockSize, size_t blocksPerSlab);
+
+void* MemoryPoolAllocate(MemoryPool* pool);
+
+void MemoryPoolFree(MemoryPool* pool, void* block);
+
+void MemoryPoolRelease(MemoryPool* pool);
@@ -19,46 +19,128 @@ HashMap PipAPI_math;
         }                                         \
     } while(false);
 
+// Keys the API reads or writes every frame. Interned once in InitializePipAPI so the natives and
+// UpdatePipAPI never have to hash a key string or probe vm.interned_strings again.
+struct PipAPIKeys
+{
+    RCString *dt;
+    RCString *left;
+    RCString *right;
+    RCString *up;
+    RCString *down;
+    RCString *w;
+    RCString *a;
+    RCString *s;
+    RCString *d;
+    RCString *mousewindowx;
+    RCString *mousewindowy;
+    RCString *mouseworldx;
+    RCString *mouseworldy;
+    RCString *camx;
+    RCString *camy;
+    RCString *x;
+    RCString *y;
+    RCString *h;
+    RCString *r;
+    RCString *g;
+    RCString *b;
+};
+static PipAPIKeys Key;
+
+static RCString *rectKeys[4];  // x y w h
+static RCString *colorKeys[4]; // r g b a
+
+static RCString *InternKey(const char *name)
+{
+    return CopyString(name, (int)strlen(name), true);
+}
+
+static void InternPipAPIKeys()
+{
+    Key.dt = InternKey("dt");
+    Key.left = InternKey("left");
+    Key.right = InternKey("right");
+    Key.up = InternKey("up");
+    Key.down = InternKey("down");
+    Key.w = InternKey("w");
+    Key.a = InternKey("a");
+    Key.s = InternKey("s");
+    Key.d = InternKey("d");
+    Key.mousewindowx = InternKey("mousewindowx");
+    Key.mousewindowy = InternKey("mousewindowy");
+    Key.mouseworldx = InternKey("mouseworldx");
+    Key.mouseworldy = InternKey("mouseworldy");
+    Key.camx = InternKey("camx");
+    Key.camy = InternKey("camy");
+    Key.x = InternKey("x");
+    Key.y = InternKey("y");
+    Key.h = InternKey("h");
+    Key.r = InternKey("r");
+    Key.g = InternKey("g");
+    Key.b = InternKey("b");
+
+    rectKeys[0] = Key.x;
+    rectKeys[1] = Key.y;
+    rectKeys[2] = Key.w;
+    rectKeys[3] = Key.h;
+    colorKeys[0] = Key.r;
+    colorKeys[1] = Key.g;
+    colorKeys[2] = Key.b;
+    colorKeys[3] = Key.a;
+}
+
+// Read the number fields keys[0..count) of map into out[0..count) in one go. Keys from requiredCount
+// onwards are optional and leave out[i] untouched if the map doesn't have them. On a missing required
+// field or a non-number field, raises a runtime error and returns false.
+static bool ReadNumberFields(HashMap *map, const char *mapName, RCString **keys, int count, int requiredCount, float *out)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        HashMapEntry *entry = HashMapGetEntry(map, keys[i]);
+        if (entry == NULL)
+        {
+            if (i < requiredCount)
+            {
+                PipLangVM_NativeRuntimeError("%s does not have %s entry", mapName, keys[i]->chars);
+                return false;
+            }
+            continue;
+        }
+        if (!IS_NUMBER(entry->value))
+        {
+            PipLangVM_NativeRuntimeError("%s.%s is not a number", mapName, keys[i]->chars);
+            return false;
+        }
+        out[i] = (float)AS_NUMBER(entry->value);
+    }
+    return true;
+}
+
+// rect: x y w h
+static bool ReadRect(HashMap *map, float rect[4])
+{
+    return ReadNumberFields(map, "rect", rectKeys, 4, 4, rect);
+}
+
+// color: r g b and optional a which defaults to 255
+static bool ReadColor(HashMap *map, float color[4])
+{
+    color[3] = 255.f;
+    return ReadNumberFields(map, "color", colorKeys, 4, 3, color);
+}
+
 static TValue GfxDrawRect(int argc, TValue *argv)
 {
     PIPVM_THROW_RUNTIME_ERROR(argc != 2, "draw rect expects 2 args");
     PIPVM_THROW_RUNTIME_ERROR(!RCOBJ_IS_MAP(argv[0]), "expect rect as first arg");
     PIPVM_THROW_RUNTIME_ERROR(!RCOBJ_IS_MAP(argv[1]), "expect color as second arg");
 
-    HashMap *rect = RCOBJ_AS_MAP(argv[0]);
-    HashMap *color = RCOBJ_AS_MAP(argv[1]);
-
-    TValue v;
-    PIPVM_THROW_RUNTIME_ERROR(!HashMapGet(rect, CopyString("x", 1, true), &v), "rect does not have x entry");
-    PIPVM_THROW_RUNTIME_ERROR(!IS_NUMBER(v), "rect.x is not a number");
-    float x = (float)AS_NUMBER(v);
-    PIPVM_THROW_RUNTIME_ERROR(!HashMapGet(rect, CopyString("y", 1, true), &v), "rect does not have y entry");
-    PIPVM_THROW_RUNTIME_ERROR(!IS_NUMBER(v), "rect.y is not a number");
-    float y = (float)AS_NUMBER(v);
-    PIPVM_THROW_RUNTIME_ERROR(!HashMapGet(rect, CopyString("w", 1, true), &v), "rect does not have w entry");
-    PIPVM_THROW_RUNTIME_ERROR(!IS_NUMBER(v), "rect.w is not a number");
-    float w = (float)AS_NUMBER(v);
-    PIPVM_THROW_RUNTIME_ERROR(!HashMapGet(rect, CopyString("h", 1, true), &v), "rect does not have h entry");
-    PIPVM_THROW_RUNTIME_ERROR(!IS_NUMBER(v), "rect.h is not a number");
-    float h = (float)AS_NUMBER(v);
-
-    PIPVM_THROW_RUNTIME_ERROR(!HashMapGet(color, CopyString("r", 1, true), &v), "color does not have r entry");
-    PIPVM_THROW_RUNTIME_ERROR(!IS_NUMBER(v), "color.r is not a number");
-    float r = (float)AS_NUMBER(v);
-    PIPVM_THROW_RUNTIME_ERROR(!HashMapGet(color, CopyString("g", 1, true), &v), "color does not have g entry");
-    PIPVM_THROW_RUNTIME_ERROR(!IS_NUMBER(v), "color.g is not a number");
-    float g = (float)AS_NUMBER(v);
-    PIPVM_THROW_RUNTIME_ERROR(!HashMapGet(color, CopyString("b", 1, true), &v), "color does not have b entry");
-    PIPVM_THROW_RUNTIME_ERROR(!IS_NUMBER(v), "color.b is not a number");
-    float b = (float)AS_NUMBER(v);
-    float a = 255.f;
-    if (HashMapGet(color, CopyString("a", 1, true), &v))
-    {
-        PIPVM_THROW_RUNTIME_ERROR(!IS_NUMBER(v), "color.a is not a number");
-        a = (float)AS_NUMBER(v);
-    }
+    float rect[4];
+    float color[4];
+    if (!ReadRect(RCOBJ_AS_MAP(argv[0]), rect)) return BOOL_VAL(false);
+    if (!ReadColor(RCOBJ_AS_MAP(argv[1]), color)) return BOOL_VAL(false);
 
-    Gfx::Primitive_DrawRect(x, y, w, h, vec4(r,g,b,a)/255.f);
+    Gfx::Primitive_DrawRect(rect[0], rect[1], rect[2], rect[3], vec4(color[0], color[1], color[2], color[3])/255.f);
 
     return BOOL_VAL(true);
 }
@@ -79,6 +161,93 @@ static TValue GfxRequestSpriteDraw(int argc, TValue *argv)
     return BOOL_VAL(true);
 }
 
+// Batch sprite draws. Both queue one sprite per position straight into the renderer's sprite batch, reading
+// f32 buffer data in place, so a tilemap or a particle system is one script call and one atlas lookup.
+//   gfx.spritebatch(spriteId, positions, tint, flip)  positions is an f32 buffer or an array of numbers laid
+//                                                     out x0 y0 x1 y1 ...
+//   gfx.sprites(spriteId, xs, ys, tint, flip)         xs and ys are f32 buffers of the same length, the layout
+//                                                     buf.addscaled particle updates work on
+// tint is an optional color map and flip an optional number: 1 flips x, 2 flips y, 3 both.
+static TValue QueueSpriteBatch(int argc, TValue *argv, int tintArg, const float *xs, const float *ys, int stride, int count)
+{
+    u32 tint = 0xffffffff;
+    if (argc > tintArg)
+    {
+        PIPVM_THROW_RUNTIME_ERROR(!RCOBJ_IS_MAP(argv[tintArg]), "tint not a color");
+        float color[4];
+        if (!ReadColor(RCOBJ_AS_MAP(argv[tintArg]), color)) return BOOL_VAL(false);
+        tint = 0;
+        for (int c = 0; c < 4; ++c)
+        {
+            float v = color[c] < 0.f ? 0.f : (color[c] > 255.f ? 255.f : color[c]);
+            tint |= (u32)(v + 0.5f) << (c * 8);
+        }
+    }
+
+    u8 flip = 0;
+    if (argc > tintArg + 1)
+    {
+        PIPVM_THROW_RUNTIME_ERROR(!IS_NUMBER(argv[tintArg + 1]), "flip not a number");
+        flip = (u8)((i64)AS_NUMBER(argv[tintArg + 1]) & (Gfx::SPRITE_FLIP_X | Gfx::SPRITE_FLIP_Y));
+    }
+
+    Gfx::QueueSpriteBatchForRender((i64)AS_NUMBER(argv[0]), xs, ys, stride, count, tint, flip);
+
+    return BOOL_VAL(true);
+}
+
+static TValue GfxRequestSpriteBatchDraw(int argc, TValue *argv)
+{
+    PIPVM_THROW_RUNTIME_ERROR(argc < 2 || argc > 4, "need 2 to 4 args");
+    PIPVM_THROW_RUNTIME_ERROR(!IS_NUMBER(argv[0]), "spriteId not a number");
+
+    const float *xy = NULL;
+    int count = 0;
+    if (RCOBJ_IS_BUFFER(argv[1]))
+    {
+        PipBuffer *positions = RCOBJ_AS_BUFFER(argv[1]);
+        PIPVM_THROW_RUNTIME_ERROR(positions->elementType != PipBuffer::F32, "positions not an f32 buffer");
+        PIPVM_THROW_RUNTIME_ERROR(positions->count % 2 != 0, "positions needs an x and a y per sprite");
+        xy = (const float*)positions->data;
+        count = positions->count / 2;
+    }
+    else if (RCOBJ_IS_ARRAY(argv[1]))
+    {
+        // arrays hold doubles so they're narrowed into a scratch buffer that keeps its size between calls
+        static std::vector<float> scratch;
+        PipArray *positions = RCOBJ_AS_ARRAY(argv[1]);
+        PIPVM_THROW_RUNTIME_ERROR(positions->count % 2 != 0, "positions needs an x and a y per sprite");
+        scratch.resize(positions->count);
+        for (int i = 0; i < positions->count; ++i)
+        {
+            PIPVM_THROW_RUNTIME_ERROR(!IS_NUMBER(positions->values[i]), "positions holds something that isn't a number");
+            scratch[i] = (float)AS_NUMBER(positions->values[i]);
+        }
+        xy = scratch.data();
+        count = positions->count / 2;
+    }
+    else
+    {
+        PIPVM_THROW_RUNTIME_ERROR(true, "positions not an f32 buffer or array");
+    }
+
+    return QueueSpriteBatch(argc, argv, 2, xy, xy + 1, 2, count);
+}
+
+static TValue GfxRequestSpritesFromBuffersDraw(int argc, TValue *argv)
+{
+    PIPVM_THROW_RUNTIME_ERROR(argc < 3 || argc > 5, "need 3 to 5 args");
+    PIPVM_THROW_RUNTIME_ERROR(!IS_NUMBER(argv[0]), "spriteId not a number");
+    PIPVM_THROW_RUNTIME_ERROR(!RCOBJ_IS_BUFFER(argv[1]) || RCOBJ_AS_BUFFER(argv[1])->elementType != PipBuffer::F32, "xs not an f32 buffer");
+    PIPVM_THROW_RUNTIME_ERROR(!RCOBJ_IS_BUFFER(argv[2]) || RCOBJ_AS_BUFFER(argv[2])->elementType != PipBuffer::F32, "ys not an f32 buffer");
+
+    PipBuffer *xs = RCOBJ_AS_BUFFER(argv[1]);
+    PipBuffer *ys = RCOBJ_AS_BUFFER(argv[2]);
+    PIPVM_THROW_RUNTIME_ERROR(xs->count != ys->count, "xs and ys not the same length");
+
+    return QueueSpriteBatch(argc, argv, 3, (const float*)xs->data, (const float*)ys->data, 1, xs->count);
+}
+
 static TValue GfxClearColor(int argc, TValue *argv)
 {
     vec4 clearColor = vec4(0.f,0.f,0.f,1.f);
@@ -87,24 +256,9 @@ static TValue GfxClearColor(int argc, TValue *argv)
     if (argc == 1)
     {
         PIPVM_THROW_RUNTIME_ERROR(!RCOBJ_IS_MAP(argv[0]), "expect color as arg");
-        HashMap *color = RCOBJ_AS_MAP(argv[0]);
-        TValue v;
-        PIPVM_THROW_RUNTIME_ERROR(!HashMapGet(color, CopyString("r", 1, true), &v), "color does not have r entry");
-        PIPVM_THROW_RUNTIME_ERROR(!IS_NUMBER(v), "color.r is not a number");
-        float r = (float)AS_NUMBER(v);
-        PIPVM_THROW_RUNTIME_ERROR(!HashMapGet(color, CopyString("g", 1, true), &v), "color does not have g entry");
-        PIPVM_THROW_RUNTIME_ERROR(!IS_NUMBER(v), "color.g is not a number");
-        float g = (float)AS_NUMBER(v);
-        PIPVM_THROW_RUNTIME_ERROR(!HashMapGet(color, CopyString("b", 1, true), &v), "color does not have b entry");
-        PIPVM_THROW_RUNTIME_ERROR(!IS_NUMBER(v), "color.b is not a number");
-        float b = (float)AS_NUMBER(v);
-        float a = 255.f;
-        if (HashMapGet(color, CopyString("a", 1, true), &v))
-        {
-            PIPVM_THROW_RUNTIME_ERROR(!IS_NUMBER(v), "color.a is not a number");
-            a = (float)AS_NUMBER(v);
-        }
-        clearColor = vec4(r, g, b, a);
+        float color[4];
+        if (!ReadColor(RCOBJ_AS_MAP(argv[0]), color)) return BOOL_VAL(false);
+        clearColor = vec4(color[0], color[1], color[2], color[3]);
     }
 
     Gfx::SetGameLayerClearColor(clearColor);
@@ -125,6 +279,20 @@ static TValue MathSin(int argc, TValue *argv)
     return NUMBER_VAL(sin(AS_NUMBER(argv[0])));
 }
 
+static TValue MathSqrt(int argc, TValue *argv)
+{
+    PIPVM_THROW_RUNTIME_ERROR(argc != 1, "expect 1 number");
+    PIPVM_THROW_RUNTIME_ERROR(!IS_NUMBER(argv[0]), "math.sqrt expect first arg to be number");
+    return NUMBER_VAL(sqrt(AS_NUMBER(argv[0])));
+}
+
+// time.clock(): seconds since the program started, for timing script code
+static TValue TimeClock(int argc, TValue *argv)
+{
+    PIPVM_THROW_RUNTIME_ERROR(argc != 0, "time.clock takes no args");
+    return NUMBER_VAL(Time.TimeSinceProgramStartInSeconds());
+}
+
 void InitializePipAPI()
 {
     if (vm.globals.entries == NULL)
@@ -133,30 +301,33 @@ void InitializePipAPI()
         return;
     }
 
+    InternPipAPIKeys();
+
     PipAPI_time = HashMap();
     AllocateHashMap(&PipAPI_time);
     ++PipAPI_time.base.refCount;
     HashMapSet(&vm.globals, CopyString("time", 4, true), RCOBJ_VAL((RCObject*)&PipAPI_time), NULL);
 
-    HashMapSet(&PipAPI_time, CopyString("dt", 2, true), NUMBER_VAL(Time.deltaTime), NULL);
+    HashMapSet(&PipAPI_time, Key.dt, NUMBER_VAL(Time.deltaTime), NULL);
+    PipLangVM_DefineNativeFn(&PipAPI_time, "clock", TimeClock);
 
     PipAPI_input = HashMap();
     AllocateHashMap(&PipAPI_input);
     ++PipAPI_input.base.refCount;
     HashMapSet(&vm.globals, CopyString("ctrl", 4, true), RCOBJ_VAL((RCObject*)&PipAPI_input), NULL);
 
-    HashMapSet(&PipAPI_input, CopyString("left", 4, true), BOOL_VAL(false), NULL);
-    HashMapSet(&PipAPI_input, CopyString("right", 5, true), BOOL_VAL(false), NULL);
-    HashMapSet(&PipAPI_input, CopyString("up", 2, true), BOOL_VAL(false), NULL);
-    HashMapSet(&PipAPI_input, CopyString("down", 4, true), BOOL_VAL(false), NULL);
-    HashMapSet(&PipAPI_input, CopyString("w", 1, true), BOOL_VAL(false), NULL);
-    HashMapSet(&PipAPI_input, CopyString("a", 1, true), BOOL_VAL(false), NULL);
-    HashMapSet(&PipAPI_input, CopyString("s", 1, true), BOOL_VAL(false), NULL);
-    HashMapSet(&PipAPI_input, CopyString("d", 1, true), BOOL_VAL(false), NULL);
-    HashMapSet(&PipAPI_input, CopyString("mousewindowx", 12, true), NUMBER_VAL(0), NULL);
-    HashMapSet(&PipAPI_input, CopyString("mousewindowy", 12, true), NUMBER_VAL(0), NULL);
-    HashMapSet(&PipAPI_input, CopyString("mouseworldx", 11, true), NUMBER_VAL(0), NULL);
-    HashMapSet(&PipAPI_input, CopyString("mouseworldy", 11, true), NUMBER_VAL(0), NULL);
+    HashMapSet(&PipAPI_input, Key.left, BOOL_VAL(false), NULL);
+    HashMapSet(&PipAPI_input, Key.right, BOOL_VAL(false), NULL);
+    HashMapSet(&PipAPI_input, Key.up, BOOL_VAL(false), NULL);
+    HashMapSet(&PipAPI_input, Key.down, BOOL_VAL(false), NULL);
+    HashMapSet(&PipAPI_input, Key.w, BOOL_VAL(false), NULL);
+    HashMapSet(&PipAPI_input, Key.a, BOOL_VAL(false), NULL);
+    HashMapSet(&PipAPI_input, Key.s, BOOL_VAL(false), NULL);
+    HashMapSet(&PipAPI_input, Key.d, BOOL_VAL(false), NULL);
+    HashMapSet(&PipAPI_input, Key.mousewindowx, NUMBER_VAL(0), NULL);
+    HashMapSet(&PipAPI_input, Key.mousewindowy, NUMBER_VAL(0), NULL);
+    HashMapSet(&PipAPI_input, Key.mouseworldx, NUMBER_VAL(0), NULL);
+    HashMapSet(&PipAPI_input, Key.mouseworldy, NUMBER_VAL(0), NULL);
 
     PipAPI_gfx = HashMap();
     AllocateHashMap(&PipAPI_gfx);
@@ -165,9 +336,11 @@ void InitializePipAPI()
 
     PipLangVM_DefineNativeFn(&PipAPI_gfx, "clear", GfxClearColor);
     PipLangVM_DefineNativeFn(&PipAPI_gfx, "sprite", GfxRequestSpriteDraw);
+    PipLangVM_DefineNativeFn(&PipAPI_gfx, "spritebatch", GfxRequestSpriteBatchDraw);
+    PipLangVM_DefineNativeFn(&PipAPI_gfx, "sprites", GfxRequestSpritesFromBuffersDraw);
     PipLangVM_DefineNativeFn(&PipAPI_gfx, "drawrect", GfxDrawRect);
-    HashMapSet(&PipAPI_gfx, CopyString("camx", 4, true), NUMBER_VAL(0), NULL);
-    HashMapSet(&PipAPI_gfx, CopyString("camy", 4, true), NUMBER_VAL(0), NULL);
+    HashMapSet(&PipAPI_gfx, Key.camx, NUMBER_VAL(0), NULL);
+    HashMapSet(&PipAPI_gfx, Key.camy, NUMBER_VAL(0), NULL);
 
     PipAPI_math = HashMap();
     AllocateHashMap(&PipAPI_math);
@@ -176,39 +349,40 @@ void InitializePipAPI()
 
     PipLangVM_DefineNativeFn(&PipAPI_math, "cos", MathCos);
     PipLangVM_DefineNativeFn(&PipAPI_math, "sin", MathSin);
+    PipLangVM_DefineNativeFn(&PipAPI_math, "sqrt", MathSqrt);
 }
 
 void UpdatePipAPI()
 {
-    HashMapSet(&PipAPI_time, CopyString("dt", 2, true), NUMBER_VAL(Time.deltaTime), NULL);
-
-    HashMapSet(&PipAPI_input, CopyString("left", 4, true), BOOL_VAL(Input.KeyPressed(SDL_SCANCODE_LEFT)), NULL);
-    HashMapSet(&PipAPI_input, CopyString("right", 5, true), BOOL_VAL(Input.KeyPressed(SDL_SCANCODE_RIGHT)), NULL);
-    HashMapSet(&PipAPI_input, CopyString("up", 2, true), BOOL_VAL(Input.KeyPressed(SDL_SCANCODE_UP)), NULL);
-    HashMapSet(&PipAPI_input, CopyString("down", 4, true), BOOL_VAL(Input.KeyPressed(SDL_SCANCODE_DOWN)), NULL);
-    HashMapSet(&PipAPI_input, CopyString("w", 1, true), BOOL_VAL(Input.KeyPressed(SDL_SCANCODE_W)), NULL);
-    HashMapSet(&PipAPI_input, CopyString("a", 1, true), BOOL_VAL(Input.KeyPressed(SDL_SCANCODE_A)), NULL);
-    HashMapSet(&PipAPI_input, CopyString("s", 1, true), BOOL_VAL(Input.KeyPressed(SDL_SCANCODE_S)), NULL);
-    HashMapSet(&PipAPI_input, CopyString("d", 1, true), BOOL_VAL(Input.KeyPressed(SDL_SCANCODE_D)), NULL);
+    HashMapSet(&PipAPI_time, Key.dt, NUMBER_VAL(Time.deltaTime), NULL);
+
+    HashMapSet(&PipAPI_input, Key.left, BOOL_VAL(Input.KeyPressed(SDL_SCANCODE_LEFT)), NULL);
+    HashMapSet(&PipAPI_input, Key.right, BOOL_VAL(Input.KeyPressed(SDL_SCANCODE_RIGHT)), NULL);
+    HashMapSet(&PipAPI_input, Key.up, BOOL_VAL(Input.KeyPressed(SDL_SCANCODE_UP)), NULL);
+    HashMapSet(&PipAPI_input, Key.down, BOOL_VAL(Input.KeyPressed(SDL_SCANCODE_DOWN)), NULL);
+    HashMapSet(&PipAPI_input, Key.w, BOOL_VAL(Input.KeyPressed(SDL_SCANCODE_W)), NULL);
+    HashMapSet(&PipAPI_input, Key.a, BOOL_VAL(Input.KeyPressed(SDL_SCANCODE_A)), NULL);
+    HashMapSet(&PipAPI_input, Key.s, BOOL_VAL(Input.KeyPressed(SDL_SCANCODE_S)), NULL);
+    HashMapSet(&PipAPI_input, Key.d, BOOL_VAL(Input.KeyPressed(SDL_SCANCODE_D)), NULL);
     ivec2 mouseWindowPos = Input.mousePos;
     ivec2 mouseGameWorldPos = Gfx::GetCoreRenderer()->TransformWindowCoordinateToGameWorldSpace(mouseWindowPos);
-    HashMapSet(&PipAPI_input, CopyString("mousewindowx", 12, true), NUMBER_VAL(mouseWindowPos.x), NULL);
-    HashMapSet(&PipAPI_input, CopyString("mousewindowy", 12, true), NUMBER_VAL(mouseWindowPos.y), NULL);
-    HashMapSet(&PipAPI_input, CopyString("mouseworldx", 11, true), NUMBER_VAL(mouseGameWorldPos.x), NULL);
-    HashMapSet(&PipAPI_input, CopyString("mouseworldy", 11, true), NUMBER_VAL(mouseGameWorldPos.y), NULL);
+    HashMapSet(&PipAPI_input, Key.mousewindowx, NUMBER_VAL(mouseWindowPos.x), NULL);
+    HashMapSet(&PipAPI_input, Key.mousewindowy, NUMBER_VAL(mouseWindowPos.y), NULL);
+    HashMapSet(&PipAPI_input, Key.mouseworldx, NUMBER_VAL(mouseGameWorldPos.x), NULL);
+    HashMapSet(&PipAPI_input, Key.mouseworldy, NUMBER_VAL(mouseGameWorldPos.y), NULL);
 
-    HashMapSet(&PipAPI_gfx, CopyString("camy", 4, true), NUMBER_VAL(Gfx::gameCamera0Position.x), NULL);
-    HashMapSet(&PipAPI_gfx, CopyString("camy", 4, true), NUMBER_VAL(Gfx::gameCamera0Position.y), NULL);
+    HashMapSet(&PipAPI_gfx, Key.camx, NUMBER_VAL(Gfx::gameCamera0Position.x), NULL);
+    HashMapSet(&PipAPI_gfx, Key.camy, NUMBER_VAL(Gfx::gameCamera0Position.y), NULL);
 }
 
 void ReadBackGfxValues()
 {
     TValue value;
-    HashMapGet(&PipAPI_gfx, CopyString("camx", 4, true), &value);
+    HashMapGet(&PipAPI_gfx, Key.camx, &value);
     if (!IS_NUMBER(value))
         PipLangVM_NativeRuntimeError("gfx.camx is not set to a number");
     Gfx::gameCamera0Position.x = (int)AS_NUMBER(value);
-    HashMapGet(&PipAPI_gfx, CopyString("camy", 4, true), &value);
+    HashMapGet(&PipAPI_gfx, Key.camy, &value);
     if (!IS_NUMBER(value))
         PipLangVM_NativeRuntimeError("gfx.camy is not set to a number");
     Gfx::gameCamera0Position.y = (int)AS_NUMBER(value);
@@ -3,6 +3,8 @@
 #define KEVIN_BYTE_BUFFER_IMPLEMENTATION
 #include "ByteBuffer.h"
 
+#include <algorithm>
+
 ProjectData projectData;
 RuntimeTextureAtlas runtimeTextureAtlas;
 
@@ -110,32 +112,210 @@ void ClearProjectData(ProjectData *gameData)
 }
 
 
+u32 PackAtlasRects(const std::vector<ivec2>& sizes, i32 pageSize, i32 padding,
+                   std::vector<AtlasPackedRect> *outRects, std::vector<ivec2> *outPageSizes)
+{
+    outRects->assign(sizes.size(), AtlasPackedRect());
+    outPageSizes->clear();
+
+    std::vector<u32> order(sizes.size());
+    for (u32 i = 0; i < order.size(); ++i) order[i] = i;
+    std::sort(order.begin(), order.end(), [&sizes](u32 a, u32 b) {
+        if (sizes[a].y != sizes[b].y) return sizes[a].y > sizes[b].y;
+        if (sizes[a].x != sizes[b].x) return sizes[a].x > sizes[b].x;
+        return a < b;
+    });
+
+    // Next-fit shelves: fill a row left to right, start a new row under the tallest rect of the
+    // previous one, start a new page when the row doesn't fit.
+    i32 openPage = -1;
+    i32 cursorX = 0;
+    i32 shelfY = 0;
+    i32 shelfHeight = 0;
+    for (u32 index : order)
+    {
+        i32 w = sizes[index].x;
+        i32 h = sizes[index].y;
+        AtlasPackedRect& rect = outRects->at(index);
+        rect.w = w;
+        rect.h = h;
+
+        if (w + 2 * padding > pageSize || h + 2 * padding > pageSize)
+        {
+            rect.page = (u32)outPageSizes->size();
+            outPageSizes->push_back(ivec2(w, h));
+            continue;
+        }
+
+        if (openPage >= 0 && cursorX + w + padding > pageSize)
+        {
+            cursorX = padding;
+            shelfY += shelfHeight + padding;
+            shelfHeight = 0;
+        }
+        if (openPage < 0 || shelfY + h + padding > pageSize)
+        {
+            openPage = (i32)outPageSizes->size();
+            outPageSizes->push_back(ivec2(pageSize, pageSize));
+            cursorX = padding;
+            shelfY = padding;
+            shelfHeight = 0;
+        }
+
+        rect.page = (u32)openPage;
+        rect.x = cursorX;
+        rect.y = shelfY;
+        cursorX += w + padding;
+        shelfHeight = GM_max(shelfHeight, h);
+    }
+
+    return (u32)outPageSizes->size();
+}
+
+void TestPackAtlasRects()
+{
+    const i32 pageSize = 256;
+    const i32 padding = 1;
+
+    // fixed LCG so every run checks the same sizes
+    u32 seed = 12345;
+    auto next = [&seed](u32 range) { seed = seed * 1664525u + 1013904223u; return (i32)((seed >> 8) % range); };
+    std::vector<ivec2> sizes;
+    for (int i = 0; i < 500; ++i) sizes.push_back(ivec2(next(64) + 1, next(64) + 1));
+    sizes.push_back(ivec2(pageSize + 40, 12)); // bigger than a page
+    sizes.push_back(ivec2(0, 0));
+    sizes.push_back(ivec2(0, 9));
+    sizes.push_back(ivec2(pageSize - 2 * padding, pageSize - 2 * padding)); // fills a page exactly
+
+    std::vector<AtlasPackedRect> rects;
+    std::vector<ivec2> pageSizes;
+    u32 pageCount = PackAtlasRects(sizes, pageSize, padding, &rects, &pageSizes);
+
+    if (rects.size() != sizes.size() || pageSizes.size() != pageCount)
+    {
+        PrintLog.Error("testatlaspacker: wrong number of rects or pages.");
+        return;
+    }
+    for (size_t i = 0; i < rects.size(); ++i)
+    {
+        const AtlasPackedRect& r = rects[i];
+        if (r.w != sizes[i].x || r.h != sizes[i].y || r.page >= pageCount ||
+            r.x < 0 || r.y < 0 || r.x + r.w > pageSizes[r.page].x || r.y + r.h > pageSizes[r.page].y)
+        {
+            PrintLog.Error("testatlaspacker: rect " + std::to_string(i) + " is out of bounds.");
+            return;
+        }
+    }
+    for (size_t i = 0; i < rects.size(); ++i)
+    {
+        for (size_t j = i + 1; j < rects.size(); ++j)
+        {
+            const AtlasPackedRect& a = rects[i];
+            const AtlasPackedRect& b = rects[j];
+            if (a.page == b.page &&
+                a.x < b.x + b.w && b.x < a.x + a.w && a.y < b.y + b.h && b.y < a.y + a.h)
+            {
+                PrintLog.Error("testatlaspacker: rects " + std::to_string(i) + " and " +
+                               std::to_string(j) + " overlap.");
+                return;
+            }
+        }
+    }
+
+    std::vector<AtlasPackedRect> again;
+    std::vector<ivec2> againPageSizes;
+    PackAtlasRects(sizes, pageSize, padding, &again, &againPageSizes);
+    bool same = againPageSizes.size() == pageSizes.size();
+    for (size_t i = 0; same && i < pageSizes.size(); ++i)
+    {
+        same = againPageSizes[i].x == pageSizes[i].x && againPageSizes[i].y == pageSizes[i].y;
+    }
+    for (size_t i = 0; same && i < rects.size(); ++i)
+    {
+        same = again[i].page == rects[i].page && again[i].x == rects[i].x && again[i].y == rects[i].y;
+    }
+    if (!same)
+    {
+        PrintLog.Error("testatlaspacker: packing the same sizes twice gave different results.");
+        return;
+    }
+
+    PrintLog.Message("testatlaspacker: " + std::to_string(rects.size()) + " rects on " +
+                     std::to_string(pageCount) + " pages, in bounds, no overlaps, same result twice.");
+}
+
+#define RUNTIME_ATLAS_PAGE_SIZE 1024
+#define RUNTIME_ATLAS_PADDING 1
+
 void CompileRuntimeTextureAtlas(RuntimeTextureAtlas *atlas, ProjectData *gameData)
 {
-    atlas->textureAtlas.clear();
-    for (int i = 0; i < gameData->spriteData.size(); ++i)
+    TearDownRuntimeTextureAtlas(atlas);
+
+    std::vector<ivec2> sizes;
+    for (SpriteData& sprd : gameData->spriteData)
     {
-        SpriteData sprd = gameData->spriteData.at(i);
-        Gfx::TextureHandle texForThisSprite;
-        SpriteImageToGPUTexture(&texForThisSprite, &sprd.frame);
+        sizes.push_back(ivec2(sprd.frame.w, sprd.frame.h));
+    }
 
-        atlas->textureAtlas.push_back(texForThisSprite);
+    std::vector<AtlasPackedRect> rects;
+    std::vector<ivec2> pageSizes;
+    u32 pageCount = PackAtlasRects(sizes, RUNTIME_ATLAS_PAGE_SIZE, RUNTIME_ATLAS_PADDING, &rects, &pageSizes);
+
+    std::vector<std::vector<SpriteColor>> pagePixels(pageCount);
+    for (u32 page = 0; page < pageCount; ++page)
+    {
+        pagePixels[page].resize((size_t)pageSizes[page].x * pageSizes[page].y);
+    }
+
+    for (size_t i = 0; i < rects.size(); ++i)
+    {
+        const SpriteImage& frame = gameData->spriteData[i].frame;
+        const AtlasPackedRect& rect = rects[i];
+        i32 pageWidth = pageSizes[rect.page].x;
+        for (i32 row = 0; row < rect.h; ++row)
+        {
+            memcpy(&pagePixels[rect.page][(size_t)(rect.y + row) * pageWidth + rect.x],
+                   &frame.pixels[(size_t)row * frame.w], sizeof(SpriteColor) * rect.w);
+        }
+    }
+
+    for (u32 page = 0; page < pageCount; ++page)
+    {
+        atlas->pages.push_back(Gfx::CreateGPUTextureFromBitmap((unsigned char*)pagePixels[page].data(),
+                                                               pageSizes[page].x, pageSizes[page].y,
+                                                               GL_RGBA, GL_RGBA, GL_NEAREST));
+    }
+
+    for (const AtlasPackedRect& rect : rects)
+    {
+        float pageWidth = (float)pageSizes[rect.page].x;
+        float pageHeight = (float)pageSizes[rect.page].y;
+        AtlasSprite sprite;
+        sprite.textureId = atlas->pages[rect.page].textureId;
+        sprite.width = rect.w;
+        sprite.height = rect.h;
+        sprite.uvMin = vec2((float)rect.x / pageWidth, (float)rect.y / pageHeight);
+        sprite.uvMax = vec2((float)(rect.x + rect.w) / pageWidth, (float)(rect.y + rect.h) / pageHeight);
+        atlas->sprites.push_back(sprite);
     }
 }
 
 void TearDownRuntimeTextureAtlas(RuntimeTextureAtlas *atlas)
 {
-    // TODO glDeleteTextures in GfxDataTypesAndUtility
+    for (Gfx::TextureHandle& page : atlas->pages)
+    {
+        glDeleteTextures(1, &page.textureId);
+    }
+    atlas->pages.clear();
+    atlas->sprites.clear();
 }
 
-Gfx::TextureHandle MapIntoTextureAtlas(RuntimeTextureAtlas *atlas, u32 spriteId)
+AtlasSprite MapIntoTextureAtlas(RuntimeTextureAtlas *atlas, u32 spriteId)
 {
-    if (atlas->textureAtlas.size() < spriteId)
+    if (spriteId >= atlas->sprites.size())
     {
         PrintLog.Error("spriteId doesn't exist.");
         return {};
     }
-    return atlas->textureAtlas.at(spriteId);
+    return atlas->sprites[spriteId];
 }
-
-
@@ -31,15 +31,46 @@ void DeserializeProjectData(const char *path, ProjectData *gameData);
 void ClearProjectData(ProjectData *gameData);
 
 
+// Where one sprite ended up when packing. Pure data so the packer can run (and be checked) without a GPU.
+struct AtlasPackedRect
+{
+    u32 page = 0;
+    i32 x = 0;
+    i32 y = 0;
+    i32 w = 0;
+    i32 h = 0;
+};
+
+/* Shelf-packs rectangles of the given sizes into pages of pageSize x pageSize with padding pixels between
+   them. Fills outRects (same order as sizes) and returns the number of pages used. Deterministic: sizes are
+   placed tallest first, ties broken by width then by index. A size bigger than a page gets a page to itself
+   (that page is as big as the rect) so every sprite always gets a rect. */
+u32 PackAtlasRects(const std::vector<ivec2>& sizes, i32 pageSize, i32 padding,
+                   std::vector<AtlasPackedRect> *outRects, std::vector<ivec2> *outPageSizes);
+
+// Console command testatlaspacker: packs a fixed pseudo-random set of sizes and checks every rect is in bounds,
+// none overlap, and packing the same sizes again gives the same result. Logs the outcome.
+void TestPackAtlasRects();
+
+// A sprite's page texture and the sub-rectangle of it that holds the sprite
+struct AtlasSprite
+{
+    GLuint textureId = 0;
+    i32 width = 0;
+    i32 height = 0;
+    vec2 uvMin = vec2(0.f, 0.f); // uv at the sprite's bottom left
+    vec2 uvMax = vec2(1.f, 1.f); // uv at the sprite's top right
+};
+
 struct RuntimeTextureAtlas
 {
-    // need a mapping from sprite name/index + frame/animation to uv in TextureAtlas
-    std::vector<Gfx::TextureHandle> textureAtlas;
+    std::vector<Gfx::TextureHandle> pages;
+    std::vector<AtlasSprite> sprites; // indexed by sprite id
 };
 
 void CompileRuntimeTextureAtlas(RuntimeTextureAtlas *atlas, ProjectData *gameData);
 void TearDownRuntimeTextureAtlas(RuntimeTextureAtlas *atlas);
-Gfx::TextureHandle MapIntoTextureAtlas(RuntimeTextureAtlas *atlas, u32 spriteId);
+AtlasSprite MapIntoTextureAtlas(RuntimeTextureAtlas *atlas, u32 spriteId);
 //void MapSpriteNameToSpriteId();
 
 
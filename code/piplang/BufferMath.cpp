@@ -0,0 +1,355 @@
+#include "BufferMath.h"
+
+#include <cmath>
+
+#ifdef PIPLANG_SIMD
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define BUFFER_MATH_SSE2
+#define BUFFER_MATH_AVX2
+#else
+#define BUFFER_MATH_SSE2 __attribute__((target("sse2")))
+#define BUFFER_MATH_AVX2 __attribute__((target("avx2")))
+#endif
+#endif // PIPLANG_SIMD
+
+// Note(Kevin): sin/cos are Cephes' sinf/cosf. |x| is reduced to [-pi/4, pi/4] around the nearest even
+//              multiple of pi/4 (pi/4 split in three parts so the reduction stays exact for |x| < 8192) and
+//              the octant picks the sine or cosine polynomial and the sign. The SIMD versions below do the
+//              exact same float operations in the same order so every path gives the same bits.
+#define SINCOS_MAX_INPUT 8192.0f
+#define FOUR_OVER_PI     1.27323954473516f
+#define PI_4_A           0.78515625f
+#define PI_4_B           2.4187564849853515625e-4f
+#define PI_4_C           3.77489497744594108e-8f
+#define SIN_C0           -1.9515295891e-4f
+#define SIN_C1           8.3321608736e-3f
+#define SIN_C2           -1.6666654611e-1f
+#define COS_C0           2.443315711809948e-5f
+#define COS_C1           -1.388731625493765e-3f
+#define COS_C2           4.166664568298827e-2f
+
+static float SinCosScalar(float x, bool cosine)
+{
+    float ax = fabsf(x);
+    if (!(ax <= SINCOS_MAX_INPUT)) return cosine ? cosf(x) : sinf(x); // NaN too
+
+    int j = ((int)(ax * FOUR_OVER_PI) + 1) & ~1;
+    float y = (float)j;
+    bool negative;
+    if (cosine)
+    {
+        j -= 2;
+        negative = (j & 4) == 0;
+    }
+    else
+    {
+        negative = ((j & 4) != 0) != std::signbit(x);
+    }
+
+    float r = ((ax - y * PI_4_A) - y * PI_4_B) - y * PI_4_C;
+    float z = r * r;
+    float p;
+    if (j & 2)
+    {
+        p = (COS_C0 * z + COS_C1) * z + COS_C2;
+        p = p * z * z - 0.5f * z + 1.0f;
+    }
+    else
+    {
+        p = (SIN_C0 * z + SIN_C1) * z + SIN_C2;
+        p = p * z * r + r;
+    }
+    return negative ? -p : p;
+}
+
+// min/max/clamp are written like minps/maxps: the second operand wins when either one is NaN
+static inline float ClampScalar(float x, float lo, float hi)
+{
+    x = x > lo ? x : lo;
+    return x < hi ? x : hi;
+}
+
+// _XY loops also load y, the second operand: b[i] or the scalar s
+#define BUFFER_MATH_SCALAR_LOOP(expr) \
+    for (int i = 0; i < n; ++i)       \
+    {                                 \
+        float x = a[i];               \
+        dst[i] = (expr);              \
+    }                                 \
+    break;
+#define BUFFER_MATH_SCALAR_LOOP_XY(expr) \
+    for (int i = 0; i < n; ++i)          \
+    {                                    \
+        float x = a[i];                  \
+        float y = b ? b[i] : s;          \
+        dst[i] = (expr);                 \
+    }                                    \
+    break;
+
+static void ScalarKernel(BufferMathOp op, float *dst, const float *a, const float *b, float s, float t, int n)
+{
+    switch (op)
+    {
+        case BufferMathOp::SIN:   BUFFER_MATH_SCALAR_LOOP(SinCosScalar(x, false))
+        case BufferMathOp::COS:   BUFFER_MATH_SCALAR_LOOP(SinCosScalar(x, true))
+        case BufferMathOp::SQRT:  BUFFER_MATH_SCALAR_LOOP(sqrtf(x))
+        case BufferMathOp::LERP:  BUFFER_MATH_SCALAR_LOOP_XY(x + (y - x) * t)
+        case BufferMathOp::MIN:   BUFFER_MATH_SCALAR_LOOP_XY(x < y ? x : y)
+        case BufferMathOp::MAX:   BUFFER_MATH_SCALAR_LOOP_XY(x > y ? x : y)
+        case BufferMathOp::CLAMP: BUFFER_MATH_SCALAR_LOOP(ClampScalar(x, s, t))
+    }
+}
+
+#undef BUFFER_MATH_SCALAR_LOOP
+#undef BUFFER_MATH_SCALAR_LOOP_XY
+
+#ifdef PIPLANG_SIMD
+
+// Lanes of in that the polynomial doesn't cover (set in mask) are redone with sinf/cosf
+static void SinCosOutOfRangeLanes(float *out, const float *in, int mask, bool cosine)
+{
+    for (int k = 0; mask; ++k, mask >>= 1)
+    {
+        if (mask & 1) out[k] = SinCosScalar(in[k], cosine);
+    }
+}
+
+BUFFER_MATH_SSE2 static inline __m128 SinCosSse2(__m128 x, bool cosine)
+{
+    const __m128 signBit = _mm_castsi128_ps(_mm_set1_epi32((int)0x80000000));
+    __m128 ax = _mm_andnot_ps(signBit, x);
+    __m128i j = _mm_cvttps_epi32(_mm_mul_ps(ax, _mm_set1_ps(FOUR_OVER_PI)));
+    j = _mm_and_si128(_mm_add_epi32(j, _mm_set1_epi32(1)), _mm_set1_epi32(~1));
+    __m128 y = _mm_cvtepi32_ps(j);
+    __m128 sign;
+    if (cosine)
+    {
+        j = _mm_sub_epi32(j, _mm_set1_epi32(2));
+        sign = _mm_castsi128_ps(_mm_slli_epi32(_mm_andnot_si128(j, _mm_set1_epi32(4)), 29));
+    }
+    else
+    {
+        sign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(j, _mm_set1_epi32(4)), 29));
+        sign = _mm_xor_ps(sign, _mm_and_ps(x, signBit));
+    }
+    __m128 useCos = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(j, _mm_set1_epi32(2)), _mm_set1_epi32(2)));
+
+    __m128 r = _mm_sub_ps(ax, _mm_mul_ps(y, _mm_set1_ps(PI_4_A)));
+    r = _mm_sub_ps(r, _mm_mul_ps(y, _mm_set1_ps(PI_4_B)));
+    r = _mm_sub_ps(r, _mm_mul_ps(y, _mm_set1_ps(PI_4_C)));
+    __m128 z = _mm_mul_ps(r, r);
+
+    __m128 pc = _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(COS_C0), z), _mm_set1_ps(COS_C1)), z), _mm_set1_ps(COS_C2));
+    pc = _mm_sub_ps(_mm_mul_ps(_mm_mul_ps(pc, z), z), _mm_mul_ps(_mm_set1_ps(0.5f), z));
+    pc = _mm_add_ps(pc, _mm_set1_ps(1.0f));
+    __m128 ps = _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(SIN_C0), z), _mm_set1_ps(SIN_C1)), z), _mm_set1_ps(SIN_C2));
+    ps = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(ps, z), r), r);
+
+    __m128 p = _mm_or_ps(_mm_and_ps(useCos, pc), _mm_andnot_ps(useCos, ps));
+    return _mm_xor_ps(p, sign);
+}
+
+#define BUFFER_MATH_SSE2_LOOP(expr)                           \
+    for (; i + 4 <= n; i += 4)                                \
+    {                                                         \
+        __m128 x = _mm_loadu_ps(a + i);                       \
+        _mm_storeu_ps(dst + i, (expr));                       \
+    }                                                         \
+    break;
+#define BUFFER_MATH_SSE2_LOOP_XY(expr)                        \
+    for (; i + 4 <= n; i += 4)                                \
+    {                                                         \
+        __m128 x = _mm_loadu_ps(a + i);                       \
+        __m128 y = b ? _mm_loadu_ps(b + i) : vs;              \
+        _mm_storeu_ps(dst + i, (expr));                       \
+    }                                                         \
+    break;
+
+BUFFER_MATH_SSE2 static void Sse2Kernel(BufferMathOp op, float *dst, const float *a, const float *b, float s, float t, int n)
+{
+    int i = 0;
+    __m128 vs = _mm_set1_ps(s);
+    __m128 vt = _mm_set1_ps(t);
+    switch (op)
+    {
+        case BufferMathOp::SIN:
+        case BufferMathOp::COS:
+        {
+            bool cosine = op == BufferMathOp::COS;
+            const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+            for (; i + 4 <= n; i += 4)
+            {
+                __m128 x = _mm_loadu_ps(a + i);
+                __m128 outOfRange = _mm_cmpnle_ps(_mm_and_ps(x, absMask), _mm_set1_ps(SINCOS_MAX_INPUT));
+                float in[4];
+                _mm_storeu_ps(in, x); // dst may be a
+                _mm_storeu_ps(dst + i, SinCosSse2(x, cosine));
+                int mask = _mm_movemask_ps(outOfRange);
+                if (mask) SinCosOutOfRangeLanes(dst + i, in, mask, cosine);
+            }
+            break;
+        }
+        case BufferMathOp::SQRT:  BUFFER_MATH_SSE2_LOOP(_mm_sqrt_ps(x))
+        case BufferMathOp::LERP:  BUFFER_MATH_SSE2_LOOP_XY(_mm_add_ps(x, _mm_mul_ps(_mm_sub_ps(y, x), vt)))
+        case BufferMathOp::MIN:   BUFFER_MATH_SSE2_LOOP_XY(_mm_min_ps(x, y))
+        case BufferMathOp::MAX:   BUFFER_MATH_SSE2_LOOP_XY(_mm_max_ps(x, y))
+        case BufferMathOp::CLAMP: BUFFER_MATH_SSE2_LOOP(_mm_min_ps(_mm_max_ps(x, vs), vt))
+    }
+    ScalarKernel(op, dst + i, a + i, b ? b + i : NULL, s, t, n - i);
+}
+
+#undef BUFFER_MATH_SSE2_LOOP
+#undef BUFFER_MATH_SSE2_LOOP_XY
+
+BUFFER_MATH_AVX2 static inline __m256 SinCosAvx2(__m256 x, bool cosine)
+{
+    const __m256 signBit = _mm256_castsi256_ps(_mm256_set1_epi32((int)0x80000000));
+    __m256 ax = _mm256_andnot_ps(signBit, x);
+    __m256i j = _mm256_cvttps_epi32(_mm256_mul_ps(ax, _mm256_set1_ps(FOUR_OVER_PI)));
+    j = _mm256_and_si256(_mm256_add_epi32(j, _mm256_set1_epi32(1)), _mm256_set1_epi32(~1));
+    __m256 y = _mm256_cvtepi32_ps(j);
+    __m256 sign;
+    if (cosine)
+    {
+        j = _mm256_sub_epi32(j, _mm256_set1_epi32(2));
+        sign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_andnot_si256(j, _mm256_set1_epi32(4)), 29));
+    }
+    else
+    {
+        sign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(j, _mm256_set1_epi32(4)), 29));
+        sign = _mm256_xor_ps(sign, _mm256_and_ps(x, signBit));
+    }
+    __m256 useCos = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(j, _mm256_set1_epi32(2)), _mm256_set1_epi32(2)));
+
+    __m256 r = _mm256_sub_ps(ax, _mm256_mul_ps(y, _mm256_set1_ps(PI_4_A)));
+    r = _mm256_sub_ps(r, _mm256_mul_ps(y, _mm256_set1_ps(PI_4_B)));
+    r = _mm256_sub_ps(r, _mm256_mul_ps(y, _mm256_set1_ps(PI_4_C)));
+    __m256 z = _mm256_mul_ps(r, r);
+
+    __m256 pc = _mm256_add_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(COS_C0), z), _mm256_set1_ps(COS_C1)), z), _mm256_set1_ps(COS_C2));
+    pc = _mm256_sub_ps(_mm256_mul_ps(_mm256_mul_ps(pc, z), z), _mm256_mul_ps(_mm256_set1_ps(0.5f), z));
+    pc = _mm256_add_ps(pc, _mm256_set1_ps(1.0f));
+    __m256 ps = _mm256_add_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(SIN_C0), z), _mm256_set1_ps(SIN_C1)), z), _mm256_set1_ps(SIN_C2));
+    ps = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(ps, z), r), r);
+
+    __m256 p = _mm256_blendv_ps(ps, pc, useCos);
+    return _mm256_xor_ps(p, sign);
+}
+
+#define BUFFER_MATH_AVX2_LOOP(expr)                           \
+    for (; i + 8 <= n; i += 8)                                \
+    {                                                         \
+        __m256 x = _mm256_loadu_ps(a + i);                    \
+        _mm256_storeu_ps(dst + i, (expr));                    \
+    }                                                         \
+    break;
+#define BUFFER_MATH_AVX2_LOOP_XY(expr)                        \
+    for (; i + 8 <= n; i += 8)                                \
+    {                                                         \
+        __m256 x = _mm256_loadu_ps(a + i);                    \
+        __m256 y = b ? _mm256_loadu_ps(b + i) : vs;           \
+        _mm256_storeu_ps(dst + i, (expr));                    \
+    }                                                         \
+    break;
+
+BUFFER_MATH_AVX2 static void Avx2Kernel(BufferMathOp op, float *dst, const float *a, const float *b, float s, float t, int n)
+{
+    int i = 0;
+    __m256 vs = _mm256_set1_ps(s);
+    __m256 vt = _mm256_set1_ps(t);
+    switch (op)
+    {
+        case BufferMathOp::SIN:
+        case BufferMathOp::COS:
+        {
+            bool cosine = op == BufferMathOp::COS;
+            const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+            for (; i + 8 <= n; i += 8)
+            {
+                __m256 x = _mm256_loadu_ps(a + i);
+                __m256 outOfRange = _mm256_cmp_ps(_mm256_and_ps(x, absMask), _mm256_set1_ps(SINCOS_MAX_INPUT), _CMP_NLE_UQ);
+                float in[8];
+                _mm256_storeu_ps(in, x); // dst may be a
+                _mm256_storeu_ps(dst + i, SinCosAvx2(x, cosine));
+                int mask = _mm256_movemask_ps(outOfRange);
+                if (mask) SinCosOutOfRangeLanes(dst + i, in, mask, cosine);
+            }
+            break;
+        }
+        case BufferMathOp::SQRT:  BUFFER_MATH_AVX2_LOOP(_mm256_sqrt_ps(x))
+        case BufferMathOp::LERP:  BUFFER_MATH_AVX2_LOOP_XY(_mm256_add_ps(x, _mm256_mul_ps(_mm256_sub_ps(y, x), vt)))
+        case BufferMathOp::MIN:   BUFFER_MATH_AVX2_LOOP_XY(_mm256_min_ps(x, y))
+        case BufferMathOp::MAX:   BUFFER_MATH_AVX2_LOOP_XY(_mm256_max_ps(x, y))
+        case BufferMathOp::CLAMP: BUFFER_MATH_AVX2_LOOP(_mm256_min_ps(_mm256_max_ps(x, vs), vt))
+    }
+    // the last 0-7 elements: 4 at a time then one at a time
+    Sse2Kernel(op, dst + i, a + i, b ? b + i : NULL, s, t, n - i);
+}
+
+#undef BUFFER_MATH_AVX2_LOOP
+#undef BUFFER_MATH_AVX2_LOOP_XY
+
+static bool CpuHasSse2()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[3] & (1 << 26)) != 0;
+#else
+    return __builtin_cpu_supports("sse2");
+#endif
+}
+
+static bool CpuHasAvx2()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuid(info, 1);
+    bool osSavesYmm = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+    if (!osSavesYmm) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // PIPLANG_SIMD
+
+typedef void (*BufferMathKernel)(BufferMathOp op, float *dst, const float *a, const float *b, float s, float t, int n);
+
+static BufferMathKernel kernel = NULL;
+static const char *kernelName = "scalar";
+
+static void PickKernel()
+{
+    kernel = ScalarKernel;
+#ifdef PIPLANG_SIMD
+    if (CpuHasAvx2())
+    {
+        kernel = Avx2Kernel;
+        kernelName = "avx2";
+    }
+    else if (CpuHasSse2())
+    {
+        kernel = Sse2Kernel;
+        kernelName = "sse2";
+    }
+#endif
+}
+
+void BufferMathF32(BufferMathOp op, float *dst, const float *a, const float *b, float s, float t, int n)
+{
+    if (kernel == NULL) PickKernel();
+    kernel(op, dst, a, b, s, t, n);
+}
+
+const char *BufferMathBackendName()
+{
+    if (kernel == NULL) PickKernel();
+    return kernelName;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "PipLangCommon.h"
+
+enum class BufferMathOp : u8
+{
+    SIN,
+    COS,
+    SQRT,
+    LERP,   // a + (b - a) * t
+    MIN,
+    MAX,
+    CLAMP   // between s and t
+};
+
+// dst[i] = op(a[i], b[i]) over n floats. b == NULL means s for every element. dst may be a or b.
+// sin and cos are accurate to a couple of ulp for |x| < 8192 and go through sinf/cosf beyond that.
+void BufferMathF32(BufferMathOp op, float *dst, const float *a, const float *b, float s, float t, int n);
+
+// "avx2", "sse2" or "scalar": the kernels BufferMathF32 picked for this CPU
+const char *BufferMathBackendName();
@@ -1,45 +1,406 @@
 #include "Chunk.h"
 
+#include <stdlib.h>
+#include <string.h>
+
 void InitChunk(Chunk *chunk)
 {
-    chunk->linenumbers = new std::vector<int>();
+    chunk->lines = new std::vector<LineRun>();
     chunk->bytecode = new std::vector<u8>(); // instead of dynamic array like so, I could use my linear memory allocator for all static bytecode at compile time.
     chunk->constants = new std::vector<TValue>();
+    chunk->constantLookup = new std::vector<u32>();
+    chunk->constantLookupUsed = 0;
+    chunk->constantTable = NULL;
+    chunk->lineRuns = NULL;
+    chunk->code = NULL;
+    chunk->constantCount = 0;
+    chunk->lineRunCount = 0;
+    chunk->codeSize = 0;
 }
 
 void FreeChunk(Chunk *chunk)
 {
-    chunk->linenumbers->clear();
+    if (chunk->bytecode == NULL)
+    {
+        free(chunk->constantTable); // the whole sealed block
+        chunk->constantTable = NULL;
+        chunk->lineRuns = NULL;
+        chunk->code = NULL;
+        chunk->constantCount = 0;
+        chunk->lineRunCount = 0;
+        chunk->codeSize = 0;
+        return;
+    }
+    chunk->lines->clear();
     chunk->bytecode->clear();
     chunk->constants->clear();
+    chunk->constantLookup->clear();
+    chunk->constantLookupUsed = 0;
     // Note(Kevin): I'm choosing not to delete the std::vectors. Keep them alive but just empty.
 }
 
+void SealChunk(Chunk *chunk)
+{
+    int constantCount = (int)chunk->constants->size();
+    int lineRunCount = (int)chunk->lines->size();
+    int codeSize = (int)chunk->bytecode->size();
+    // TValue first so everything stays aligned, code bytes last
+    size_t bytes = sizeof(TValue) * constantCount + sizeof(LineRun) * lineRunCount + codeSize;
+    u8 *block = (u8 *)malloc(bytes > 0 ? bytes : 1);
+
+    chunk->constantTable = (TValue *)block;
+    chunk->lineRuns = (LineRun *)(block + sizeof(TValue) * constantCount);
+    chunk->code = block + sizeof(TValue) * constantCount + sizeof(LineRun) * lineRunCount;
+    chunk->constantCount = constantCount;
+    chunk->lineRunCount = lineRunCount;
+    chunk->codeSize = codeSize;
+    for (int i = 0; i < constantCount; ++i) chunk->constantTable[i] = chunk->constants->at(i);
+    if (lineRunCount > 0) memcpy(chunk->lineRuns, chunk->lines->data(), sizeof(LineRun) * lineRunCount);
+    if (codeSize > 0) memcpy(chunk->code, chunk->bytecode->data(), codeSize);
+
+    delete chunk->lines;
+    delete chunk->bytecode;
+    delete chunk->constants;
+    delete chunk->constantLookup;
+    chunk->lines = NULL;
+    chunk->bytecode = NULL;
+    chunk->constants = NULL;
+    chunk->constantLookup = NULL;
+    chunk->constantLookupUsed = 0;
+}
+
+static void AppendLine(std::vector<LineRun> &lines, int offset, int line)
+{
+    if (lines.empty() || lines.back().line != line) lines.push_back({ (u32)offset, line });
+}
+
 void WriteChunk(Chunk *chunk, u8 byte, int line)
 {
-    chunk->linenumbers->push_back(line);
+    AppendLine(*chunk->lines, (int)chunk->bytecode->size(), line);
     chunk->bytecode->push_back(byte);
 }
 
+void TruncateChunk(Chunk *chunk, int size)
+{
+    chunk->bytecode->resize(size);
+    std::vector<LineRun> &lines = *chunk->lines;
+    while (!lines.empty() && lines.back().offset >= (u32)size) lines.pop_back();
+}
+
+int GetLine(const Chunk *chunk, int offset)
+{
+    const LineRun *lines = chunk->lineRuns;
+    // last run that starts at or before offset
+    int lo = 0;
+    int hi = chunk->lineRunCount - 1;
+    while (lo < hi)
+    {
+        int mid = (lo + hi + 1) / 2;
+        if (lines[mid].offset <= (u32)offset) lo = mid;
+        else hi = mid - 1;
+    }
+    return chunk->lineRunCount == 0 ? 0 : lines[lo].line;
+}
+
+// Numbers compare by their bits so 0 and -0 stay apart. Constant strings are interned so the pointer is the string.
+static bool IdenticalConstants(TValue a, TValue b)
+{
+    if (TVALUE_TYPE(a) != TVALUE_TYPE(b)) return false;
+    switch (TVALUE_TYPE(a))
+    {
+        case TValue::BOOLEAN: return AS_BOOL(a) == AS_BOOL(b);
+        case TValue::REAL:
+        {
+            double x = AS_NUMBER(a);
+            double y = AS_NUMBER(b);
+            return memcmp(&x, &y, sizeof(double)) == 0;
+        }
+        case TValue::FUNC: return AS_FUNCTION(a) == AS_FUNCTION(b);
+        case TValue::NATIVEFN: return AS_NATIVEFN(a) == AS_NATIVEFN(b);
+        case TValue::RCOBJ: return AS_RCOBJ(a) == AS_RCOBJ(b);
+    }
+    return false;
+}
+
+static u32 HashConstant(TValue value)
+{
+    u64 bits = 0;
+    switch (TVALUE_TYPE(value))
+    {
+        case TValue::BOOLEAN: bits = AS_BOOL(value) ? 1 : 0; break;
+        case TValue::REAL:
+        {
+            double real = AS_NUMBER(value);
+            memcpy(&bits, &real, sizeof(double));
+            break;
+        }
+        case TValue::FUNC: bits = (u64)(uintptr_t)AS_FUNCTION(value); break;
+        case TValue::NATIVEFN: bits = (u64)(uintptr_t)AS_NATIVEFN(value); break;
+        case TValue::RCOBJ: bits = (u64)(uintptr_t)AS_RCOBJ(value); break;
+    }
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdULL;
+    bits ^= bits >> 33;
+    return (u32)bits + (u32)TVALUE_TYPE(value);
+}
+
+static void InsertConstantLookup(Chunk *chunk, TValue value, u32 index)
+{
+    std::vector<u32> &lookup = *chunk->constantLookup;
+    u32 mask = (u32)lookup.size() - 1;
+    u32 slot = HashConstant(value) & mask;
+    while (lookup[slot] != 0) slot = (slot + 1) & mask;
+    lookup[slot] = index + 1;
+    ++chunk->constantLookupUsed;
+}
+
+// Keeps the lookup at most half full. Rebuilding from the constant table also throws away stale slots.
+static void ReserveConstantLookup(Chunk *chunk)
+{
+    std::vector<u32> &lookup = *chunk->constantLookup;
+    if ((chunk->constantLookupUsed + 1) * 2 <= (int)lookup.size()) return;
+
+    u32 count = (u32)chunk->constants->size();
+    u32 capacity = 16;
+    while (capacity < (count + 1) * 4) capacity *= 2;
+    lookup.assign(capacity, 0);
+    chunk->constantLookupUsed = 0;
+    for (u32 i = 0; i < count; ++i) InsertConstantLookup(chunk, chunk->constants->at(i), i);
+}
+
 u32 AddConstant(Chunk *chunk, TValue value)
 {
-    chunk->constants->push_back(value);
-    return (u32)chunk->constants->size() - 1;
+    std::vector<TValue> &constants = *chunk->constants;
+    std::vector<u32> &lookup = *chunk->constantLookup;
+    if (!lookup.empty())
+    {
+        u32 mask = (u32)lookup.size() - 1;
+        for (u32 slot = HashConstant(value) & mask; lookup[slot] != 0; slot = (slot + 1) & mask)
+        {
+            u32 index = lookup[slot] - 1;
+            if (index < constants.size() && IdenticalConstants(constants[index], value)) return index;
+        }
+    }
+
+    ReserveConstantLookup(chunk);
+    constants.push_back(value);
+    u32 index = (u32)constants.size() - 1;
+    InsertConstantLookup(chunk, value, index);
+    return index;
+}
+
+void WriteIndexedOp(Chunk *chunk, OpCode op, u32 index, int line)
+{
+    if (index <= UINT8_MAX)
+    {
+        WriteChunk(chunk, (u8)op, line);
+    }
+    else if (index <= UINT16_MAX)
+    {
+        WriteChunk(chunk, (u8)op + 1, line);
+        WriteChunk(chunk, (u8)(index >> 8), line);
+    }
+    else
+    {
+        WriteChunk(chunk, (u8)op + 2, line);
+        WriteChunk(chunk, (u8)(index >> 16), line);
+        WriteChunk(chunk, (u8)(index >> 8), line);
+    }
+    WriteChunk(chunk, (u8)index, line);
 }
 
 void WriteConstant(Chunk *chunk, TValue value, int line)
 {
-    u32 cindex = AddConstant(chunk, value);
-    if (cindex >= 256)
+    WriteIndexedOp(chunk, OpCode::CONSTANT, AddConstant(chunk, value), line);
+}
+
+static int InstructionLength(OpCode op)
+{
+    switch (op)
     {
-        WriteChunk(chunk, (u8)OpCode::CONSTANT_LONG, line);
-        WriteChunk(chunk, (u8)(cindex >> 16), line);
-        WriteChunk(chunk, (u8)(cindex >> 8), line);
-        WriteChunk(chunk, (u8)cindex, line);
+        case OpCode::CONSTANT:
+        case OpCode::DEFINE_GLOBAL:
+        case OpCode::GET_LOCAL:
+        case OpCode::SET_LOCAL:
+        case OpCode::CALL:
+            return 2;
+        case OpCode::CONSTANT_WIDE:
+        case OpCode::DEFINE_GLOBAL_WIDE:
+        case OpCode::JUMP:
+        case OpCode::JUMP_BACK:
+        case OpCode::JUMP_IF_FALSE:
+        case OpCode::JUMP_IF_FALSE_POP:
+        case OpCode::INDEX_LOCAL_CONST:
+        case OpCode::INDEX_LOCAL_LOCAL:
+            return 3;
+        case OpCode::CONSTANT_LONG:
+        case OpCode::DEFINE_GLOBAL_LONG:
+        case OpCode::ADD_LOCAL_CONST:
+        case OpCode::GET_GLOBAL:
+        case OpCode::SET_GLOBAL:
+        case OpCode::GET_FIELD:
+        case OpCode::SET_FIELD:
+            return 4;
+        case OpCode::GET_GLOBAL_WIDE:
+        case OpCode::SET_GLOBAL_WIDE:
+        case OpCode::GET_FIELD_WIDE:
+        case OpCode::SET_FIELD_WIDE:
+            return 5;
+        case OpCode::GET_GLOBAL_LONG:
+        case OpCode::SET_GLOBAL_LONG:
+        case OpCode::GET_FIELD_LONG:
+        case OpCode::SET_FIELD_LONG:
+            return 6;
+        case OpCode::REG_ADD:
+        case OpCode::REG_SUBTRACT:
+        case OpCode::REG_MULTIPLY:
+        case OpCode::REG_DIVIDE:
+        case OpCode::REG_EQUAL:
+        case OpCode::REG_GREATER:
+        case OpCode::REG_LESSER:
+            return 5;
+        default:
+            return 1;
     }
-    else
+}
+
+static bool IsJump(OpCode op)
+{
+    return op == OpCode::JUMP || op == OpCode::JUMP_BACK || op == OpCode::JUMP_IF_FALSE || op == OpCode::JUMP_IF_FALSE_POP;
+}
+
+struct PeepholeInstruction
+{
+    OpCode op;
+    u8 operands[5];
+    int line;
+    int target = -1;        // index of the instruction a jump lands on
+    int incomingJumps = 0;
+    bool removed = false;
+    int newOffset = 0;
+};
+
+void PeepholeOptimizeChunk(Chunk *chunk)
+{
+    std::vector<u8> &code = *chunk->bytecode;
+    const std::vector<LineRun> &lines = *chunk->lines;
+    int codeSize = (int)code.size();
+
+    // Decode into a list of instructions so jumps can refer to instructions instead of byte offsets
+    std::vector<PeepholeInstruction> instrs;
+    std::vector<int> instrAtOffset(codeSize + 1, -1);
+    size_t run = 0;
+    for (int offset = 0; offset < codeSize;)
     {
-        WriteChunk(chunk, (u8)OpCode::CONSTANT, line);
-        WriteChunk(chunk, (u8)cindex, line);
+        PeepholeInstruction in;
+        in.op = (OpCode)code[offset];
+        int length = InstructionLength(in.op);
+        for (int i = 1; i < length; ++i) in.operands[i - 1] = code[offset + i];
+        // runtime errors look up the line of the last byte read
+        while (run + 1 < lines.size() && lines[run + 1].offset <= (u32)(offset + length - 1)) ++run;
+        in.line = lines[run].line;
+        instrAtOffset[offset] = (int)instrs.size();
+        instrs.push_back(in);
+        offset += length;
     }
+    instrAtOffset[codeSize] = (int)instrs.size(); // one past the end
+
+    int offset = 0;
+    for (PeepholeInstruction &in : instrs)
+    {
+        int length = InstructionLength(in.op);
+        if (IsJump(in.op))
+        {
+            int jump = (in.operands[0] << 8) | in.operands[1];
+            int targetOffset = in.op == OpCode::JUMP_BACK ? offset + length - jump : offset + length + jump;
+            in.target = instrAtOffset[targetOffset];
+            PipLangAssert(in.target != -1);
+            if (in.target < (int)instrs.size()) ++instrs[in.target].incomingJumps;
+        }
+        offset += length;
+    }
+
+    // Fuse. An instruction that something jumps to can't be folded into the one before it.
+    int count = (int)instrs.size();
+    for (int i = 0; i < count; ++i)
+    {
+        PeepholeInstruction &in = instrs[i];
+        if (in.removed) continue;
+        PeepholeInstruction *next = i + 1 < count && !instrs[i + 1].removed && instrs[i + 1].incomingJumps == 0 ? &instrs[i + 1] : NULL;
+        if (next == NULL) continue;
+
+        if (in.op == OpCode::GET_LOCAL && next->op == OpCode::CONSTANT && i + 3 < count &&
+            instrs[i + 2].op == OpCode::ADD && instrs[i + 2].incomingJumps == 0 &&
+            instrs[i + 3].op == OpCode::SET_LOCAL && instrs[i + 3].incomingJumps == 0)
+        {
+            in.op = OpCode::ADD_LOCAL_CONST;
+            in.operands[1] = next->operands[0];
+            in.operands[2] = instrs[i + 3].operands[0];
+            in.line = instrs[i + 2].line;
+            next->removed = instrs[i + 2].removed = instrs[i + 3].removed = true;
+        }
+        else if (in.op == OpCode::GET_LOCAL && (next->op == OpCode::CONSTANT || next->op == OpCode::GET_LOCAL) &&
+                 i + 2 < count && instrs[i + 2].op == OpCode::GET_INDEX && instrs[i + 2].incomingJumps == 0)
+        {
+            in.op = next->op == OpCode::CONSTANT ? OpCode::INDEX_LOCAL_CONST : OpCode::INDEX_LOCAL_LOCAL;
+            in.operands[1] = next->operands[0];
+            in.line = instrs[i + 2].line;
+            next->removed = instrs[i + 2].removed = true;
+        }
+        else if (next->op == OpCode::LOGICAL_NOT &&
+                 (in.op == OpCode::RELOP_EQUAL || in.op == OpCode::RELOP_LESSER || in.op == OpCode::RELOP_GREATER))
+        {
+            in.op = in.op == OpCode::RELOP_EQUAL ? OpCode::NOT_EQUAL
+                  : in.op == OpCode::RELOP_LESSER ? OpCode::GREATER_EQUAL : OpCode::LESSER_EQUAL;
+            next->removed = true;
+        }
+        else if (in.op == OpCode::JUMP_IF_FALSE && next->op == OpCode::POP)
+        {
+            // Note(Kevin): if/while/for emit JUMP_IF_FALSE, POP and then a POP at the jump target for the
+            //              false path. When that POP can only be reached by this jump (one incoming jump
+            //              and the instruction before it never falls through), pop on both paths here and
+            //              jump past it instead.
+            int t = in.target;
+            if (t > 0 && t < count - 1 && instrs[t].op == OpCode::POP && instrs[t].incomingJumps == 1 &&
+                (instrs[t - 1].op == OpCode::JUMP || instrs[t - 1].op == OpCode::JUMP_BACK || instrs[t - 1].op == OpCode::RETURN) &&
+                !instrs[t - 1].removed)
+            {
+                in.op = OpCode::JUMP_IF_FALSE_POP;
+                in.target = t + 1;
+                ++instrs[t + 1].incomingJumps;
+                next->removed = true;
+                instrs[t].removed = true;
+            }
+        }
+    }
+
+    // Re-emit with new offsets. A jump to a removed instruction lands on the next one that is kept.
+    int newSize = 0;
+    for (PeepholeInstruction &in : instrs)
+    {
+        in.newOffset = newSize;
+        if (!in.removed) newSize += InstructionLength(in.op);
+    }
+
+    std::vector<u8> newCode;
+    std::vector<LineRun> newLines;
+    newCode.reserve(newSize);
+    for (PeepholeInstruction &in : instrs)
+    {
+        if (in.removed) continue;
+        int length = InstructionLength(in.op);
+        if (IsJump(in.op))
+        {
+            int targetOffset = in.target < count ? instrs[in.target].newOffset : newSize;
+            int jump = in.op == OpCode::JUMP_BACK ? in.newOffset + length - targetOffset : targetOffset - in.newOffset - length;
+            in.operands[0] = (u8)((jump >> 8) & 0xff);
+            in.operands[1] = (u8)(jump & 0xff);
+        }
+        newCode.push_back((u8)in.op);
+        for (int i = 1; i < length; ++i) newCode.push_back(in.operands[i - 1]);
+        AppendLine(newLines, in.newOffset, in.line);
+    }
+
+    code.swap(newCode);
+    chunk->lines->swap(newLines);
 }
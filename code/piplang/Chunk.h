@@ -4,15 +4,44 @@
 
 #include <vector>
 
+// Source line of a stretch of bytecode: every byte from offset up to the next run's offset is on line
+struct LineRun
+{
+    u32 offset;
+    int line;
+};
+
 struct Chunk
 {
-    std::vector<int> *linenumbers; // TODO(Kevin): less memory hogging line number encoding
+    // Built up while compiling. SealChunk copies them into the block below and deletes them.
+    std::vector<LineRun> *lines; // a new run only starts where the line changes, see GetLine
     std::vector<u8> *bytecode;
     std::vector<TValue> *constants;
+    // Open addressing index over constants so a repeated literal or name reuses its entry. Each slot is
+    // 0 when empty or constant index + 1. Slots can point past the end or at a different constant after
+    // the compiler drops folded constants; lookups skip those.
+    std::vector<u32> *constantLookup;
+    int constantLookupUsed;
+
+    // Sealed form, what the VM and the disassembler read. One malloc'd block laid out as constants,
+    // then line runs, then code, so a function's constant fetch is a single indexed load off constantTable.
+    TValue *constantTable;
+    LineRun *lineRuns;
+    u8 *code;
+    int constantCount;
+    int lineRunCount;
+    int codeSize;
 };
 
 void InitChunk(Chunk *chunk);
 void FreeChunk(Chunk *chunk);
 void WriteChunk(Chunk *chunk, u8 byte, int line);
-u32 AddConstant(Chunk *chunk, TValue value);
+void TruncateChunk(Chunk *chunk, int size); // drops bytecode from size on, constants stay
+void SealChunk(Chunk *chunk); // compiler is done with chunk, nothing can be written to it after
+int GetLine(const Chunk *chunk, int offset); // sealed chunks only
+u32 AddConstant(Chunk *chunk, TValue value); // index of an identical constant if there is one already
 void WriteConstant(Chunk *chunk, TValue value, int line);
+// op followed by a constant table index. op is the one byte operand form and its _WIDE (two byte) and
+// _LONG (three byte) forms follow it in OpCode, the narrowest one that fits index is written.
+void WriteIndexedOp(Chunk *chunk, OpCode op, u32 index, int line);
+void PeepholeOptimizeChunk(Chunk *chunk);
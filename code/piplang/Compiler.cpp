@@ -32,27 +32,88 @@ struct ParseRule
 static void ParsePrecedence(Precedence precedence);
 static ParseRule *GetParseRule(TokenType type);
 
+static void ErrorAt(Token *token, const char *message);
+
+// Tokens are pulled from the scanner as the parser asks for them instead of tokenizing the whole source
+// up front. They go through a ring buffer indexed by absolute token position so preview mode can rewind:
+// only the tokens from a little before the preview start up to the furthest token scanned have to stay
+// around. Outside of preview nothing is kept, so the ring stays as small as the longest previewed
+// expression no matter how long the script is.
 struct TokenSequence
 {
     Token *tokens = NULL;
-    //Token tokens[4096];
-    int numTokens = 0;
-    int cursor = 0;
+    int capacity = 0;   // power of two
+    int numTokens = 0;  // tokens scanned so far
+    int cursor = 0;     // absolute position of the next token Advance returns
+    int keepFrom = -1;  // oldest absolute position that must stay in the ring, -1 when not previewing
+    bool reachedEnd = false;
 
     void Allocate()
     {
         numTokens = 0;
         cursor = 0;
+        keepFrom = -1;
+        reachedEnd = false;
         if (tokens == NULL)
-            tokens = (Token*)calloc(4096, sizeof(Token));
+        {
+            capacity = 64;
+            tokens = (Token*)calloc(capacity, sizeof(Token));
+        }
     }
 
     void Free()
     {
         free(tokens);
+        tokens = NULL;
+        capacity = 0;
         numTokens = 0;
         cursor = 0;
     }
+
+    Token& At(int position)
+    {
+        PipLangAssert(position < numTokens && (keepFrom < 0 || position >= keepFrom));
+        return tokens[position & (capacity - 1)];
+    }
+
+    void Grow()
+    {
+        int newCapacity = capacity * 2;
+        Token *newTokens = (Token*)calloc(newCapacity, sizeof(Token));
+        for (int i = keepFrom; i < numTokens; ++i)
+            newTokens[i & (newCapacity - 1)] = tokens[i & (capacity - 1)];
+        free(tokens);
+        tokens = newTokens;
+        capacity = newCapacity;
+    }
+
+    Token Next()
+    {
+        if (cursor < numTokens) return At(cursor++); // replaying after a preview
+
+        if (keepFrom >= 0 && numTokens - keepFrom >= capacity) Grow();
+
+        Token t;
+        if (reachedEnd)
+        {
+            t = tokens[(numTokens - 1) & (capacity - 1)];
+        }
+        else
+        {
+            t = ScanToken();
+            if (t.type == TokenType::ERROR)
+            {
+                // report it and stand in an end of file so the parser winds down
+                ErrorAt(&t, t.start);
+                t.type = TokenType::END_OF_FILE;
+            }
+            reachedEnd = t.type == TokenType::END_OF_FILE;
+        }
+        tokens[numTokens & (capacity - 1)] = t;
+        ++numTokens;
+        ++cursor;
+        return t;
+    }
 };
 
 TokenSequence tokensequence;
@@ -72,6 +133,8 @@ struct Parser
     {
         if (previewMode) PipLangAssert(0);
         cachedCursorPosBeforePreview = tokensequence.cursor;
+        // keep enough behind the preview start to restore previousprevious when rewinding
+        tokensequence.keepFrom = cachedCursorPosBeforePreview < 3 ? 0 : cachedCursorPosBeforePreview - 3;
         previewMode = true;
     }
 
@@ -79,9 +142,10 @@ struct Parser
     {
         if (!previewMode) PipLangAssert(0);
         tokensequence.cursor = cachedCursorPosBeforePreview;
-        current = tokensequence.cursor < 1 ? Token() : tokensequence.tokens[tokensequence.cursor - 1];
-        previous = tokensequence.cursor < 2 ? Token() : tokensequence.tokens[tokensequence.cursor - 2];
-        previousprevious = tokensequence.cursor < 3 ? Token() : tokensequence.tokens[tokensequence.cursor - 3];
+        current = tokensequence.cursor < 1 ? Token() : tokensequence.At(tokensequence.cursor - 1);
+        previous = tokensequence.cursor < 2 ? Token() : tokensequence.At(tokensequence.cursor - 2);
+        previousprevious = tokensequence.cursor < 3 ? Token() : tokensequence.At(tokensequence.cursor - 3);
+        tokensequence.keepFrom = -1;
         previewMode = false;
     }
 
@@ -89,7 +153,7 @@ struct Parser
     {
         PipLangAssert(cachedCursorPosBeforePreview > 0);
         for (int i = cachedCursorPosBeforePreview - 1; i < tokensequence.cursor; ++i)
-            if (tokensequence.tokens[i].type == type) return true;
+            if (tokensequence.At(i).type == type) return true;
         return false;
     }
 };
@@ -106,6 +170,30 @@ enum class CompilingToType
     TOPLEVELSCRIPT
 };
 
+#ifdef PIPLANG_REGISTER_BACKEND
+// A local or constant read that hasn't been emitted yet. If the next thing to consume it is a
+// binary op, it becomes a REG_* operand instead of a GET_LOCAL/CONSTANT push. Anything else that
+// emits bytecode flushes it first (see FlushPendingOperand).
+struct PendingOperand
+{
+    RegOperand kind = REG_STACK; // REG_STACK means nothing pending
+    u8 index = 0;
+    int line = 0;
+};
+#endif
+
+// The code of a literal, or of an expression folded from literals, and its value. An operator or a
+// condition applied to it can then be evaluated at compile time and the code thrown away.
+struct ConstantExpression
+{
+    int start = -1;         // bytecode offset of its code, -1 if there's no such expression
+    int end = -1;           // bytecode offset just past its code
+    int constantIndex = -1; // its entry in the constant table, -1 for true and false
+    bool addedConstant = false; // the entry was made for it rather than shared with an identical constant
+    bool pending = false;   // register backend: held as the pending REG_CONST operand, not written out
+    TValue value;
+};
+
 struct Compiler
 {
     Compiler *enclosing;
@@ -115,6 +203,14 @@ struct Compiler
     Local locals[256];
     int localCount;
     int scopeDepth;
+
+    ConstantExpression lastConstant;
+
+#ifdef PIPLANG_REGISTER_BACKEND
+    PendingOperand pending;
+    int lastRegOp;      // bytecode offset of the last REG_* instruction
+    int lastJumpTarget; // bytecode offset the last patched jump lands on
+#endif
 };
 
 Parser parser;
@@ -130,6 +226,12 @@ static void InitCompiler(Compiler *compiler, CompilingToType compilingToType)
 
     compiler->localCount = 0;
     compiler->scopeDepth = 0;
+    compiler->lastConstant = ConstantExpression();
+#ifdef PIPLANG_REGISTER_BACKEND
+    compiler->pending = PendingOperand();
+    compiler->lastRegOp = -1;
+    compiler->lastJumpTarget = -1;
+#endif
     compiler->compilingTo = NewFunction();
     current = compiler;
     if (compilingToType != CompilingToType::TOPLEVELSCRIPT)
@@ -182,7 +284,7 @@ static void Advance()
 {
     parser.previousprevious = parser.previous;
     parser.previous = parser.current;
-    parser.current = tokensequence.tokens[tokensequence.cursor++];
+    parser.current = tokensequence.Next();
 }
 
 static void Eat(TokenType type, const char *errorMsg)
@@ -234,10 +336,47 @@ static Chunk *CurrentChunk()
     return &current->compilingTo->chunk;
 }
 
+#ifdef PIPLANG_REGISTER_BACKEND
+static void FlushPendingOperand()
+{
+    if (parser.previewMode) return;
+
+    PendingOperand p = current->pending;
+    if (p.kind == REG_STACK) return;
+
+    current->pending.kind = REG_STACK;
+    WriteChunk(CurrentChunk(), (u8)(p.kind == REG_LOCAL ? OpCode::GET_LOCAL : OpCode::CONSTANT), p.line);
+    WriteChunk(CurrentChunk(), p.index, p.line);
+}
+
+static void SetPendingOperand(RegOperand kind, u8 index)
+{
+    if (parser.previewMode) return;
+
+    FlushPendingOperand();
+    current->pending.kind = kind;
+    current->pending.index = index;
+    current->pending.line = parser.previous.line;
+}
+
+// A previewed expression emits nothing, so it must not take the real pending operand either
+static PendingOperand TakePendingOperand()
+{
+    if (parser.previewMode) return PendingOperand();
+
+    PendingOperand p = current->pending;
+    current->pending.kind = REG_STACK;
+    return p;
+}
+#endif
+
 static void EmitByte(u8 byte)
 {
     if (parser.previewMode) return;
 
+#ifdef PIPLANG_REGISTER_BACKEND
+    FlushPendingOperand();
+#endif
     WriteChunk(CurrentChunk(), byte, parser.previous.line);
 }
 
@@ -248,11 +387,35 @@ static void EmitByte(OpCode op)
     EmitByte((u8)op);
 }
 
-static void EmitConstant(TValue value)
+// op and its constant index operand, see WriteIndexedOp
+static void EmitIndexedOp(OpCode op, u32 index)
 {
     if (parser.previewMode) return;
 
-    WriteConstant(CurrentChunk(), value, parser.previous.line);
+    if (index > 0xffffff)
+    {
+        Error("Too many constants in one chunk.");
+        return;
+    }
+#ifdef PIPLANG_REGISTER_BACKEND
+    FlushPendingOperand();
+#endif
+    WriteIndexedOp(CurrentChunk(), op, index, parser.previous.line);
+}
+
+// Constant that is the value of an expression (literals) so it can be used as a REG_* operand
+static void EmitConstantOperand(u32 index)
+{
+#ifdef PIPLANG_REGISTER_BACKEND
+    if (parser.previewMode) return;
+
+    if (index <= UINT8_MAX)
+    {
+        SetPendingOperand(REG_CONST, (u8)index);
+        return;
+    }
+#endif
+    EmitIndexedOp(OpCode::CONSTANT, index);
 }
 
 static void EmitBytes(u8 byte1, u8 byte2)
@@ -267,6 +430,11 @@ static void PatchJump(int index)
 {
     if (parser.previewMode) return;
 
+#ifdef PIPLANG_REGISTER_BACKEND
+    FlushPendingOperand();
+    current->lastJumpTarget = (int)CurrentChunk()->bytecode->size();
+#endif
+
     u16 jump = (u16)((int)CurrentChunk()->bytecode->size() - index - 2); // 2 bytecodes for jump offset
 
     if (jump > UINT16_MAX) 
@@ -276,6 +444,9 @@ static void PatchJump(int index)
 
     CurrentChunk()->bytecode->at(index)     = (jump >> 8) & 0xff;
     CurrentChunk()->bytecode->at(index + 1) = jump & 0xff;
+
+    // code jumps here from before the last constant so whatever ends here isn't just that constant
+    current->lastConstant.start = -1;
 }
 
 static int EmitJump(OpCode op)
@@ -305,6 +476,183 @@ static void EmitLoop(int loopStart)
     EmitByte(jump & 0xff);
 }
 
+// Offset of the next instruction, for EmitLoop to jump back to
+static int LoopStart()
+{
+#ifdef PIPLANG_REGISTER_BACKEND
+    // a local initializer can still be pending and would otherwise be emitted inside the loop
+    FlushPendingOperand();
+    current->lastJumpTarget = (int)CurrentChunk()->bytecode->size();
+#endif
+    return (int)CurrentChunk()->bytecode->size();
+}
+
+// Offset the code of the next expression or statement starts at
+static int NextCodeOffset()
+{
+#ifdef PIPLANG_REGISTER_BACKEND
+    FlushPendingOperand();
+#endif
+    return (int)CurrentChunk()->bytecode->size();
+}
+
+// Throw away everything emitted from offset on: operands that were folded or a branch that can't run
+static void TruncateCode(int offset)
+{
+    if (parser.previewMode) return;
+
+    TruncateChunk(CurrentChunk(), offset);
+    current->lastConstant.start = -1;
+#ifdef PIPLANG_REGISTER_BACKEND
+    current->pending.kind = REG_STACK;
+    if (current->lastRegOp >= offset) current->lastRegOp = -1;
+    if (current->lastJumpTarget > offset) current->lastJumpTarget = -1;
+#endif
+}
+
+// Number, string, true or false
+static void EmitLiteral(TValue value)
+{
+    if (parser.previewMode) return;
+
+    ConstantExpression c;
+    c.start = NextCodeOffset();
+    c.value = value;
+    if (IS_BOOL(value))
+    {
+        EmitByte(AS_BOOL(value) ? OpCode::OP_TRUE : OpCode::OP_FALSE);
+    }
+    else
+    {
+        size_t constantCount = CurrentChunk()->constants->size();
+        c.constantIndex = (int)AddConstant(CurrentChunk(), value);
+        c.addedConstant = CurrentChunk()->constants->size() > constantCount;
+        EmitConstantOperand((u32)c.constantIndex);
+#ifdef PIPLANG_REGISTER_BACKEND
+        c.pending = current->pending.kind == REG_CONST;
+#endif
+    }
+    c.end = (int)CurrentChunk()->bytecode->size();
+    current->lastConstant = c;
+}
+
+// Whether the code emitted last is a constant expression, and which
+static bool LastExpressionIsConstant(ConstantExpression *out)
+{
+    if (parser.previewMode) return false;
+
+    ConstantExpression c = current->lastConstant;
+    if (c.start < 0 || c.end != (int)CurrentChunk()->bytecode->size()) return false;
+#ifdef PIPLANG_REGISTER_BACKEND
+    bool pendingMatches = c.pending
+        ? current->pending.kind == REG_CONST && current->pending.index == (u8)c.constantIndex
+        : current->pending.kind == REG_STACK;
+    if (!pendingMatches) return false;
+#endif
+    *out = c;
+    return true;
+}
+
+// Drop a constant that a folded expression no longer uses. Only one the expression added itself and
+// that's still the newest entry can go, anything else might be referenced by other code.
+static void ReleaseFoldedConstant(const ConstantExpression& folded)
+{
+    std::vector<TValue> *constants = CurrentChunk()->constants;
+    if (folded.addedConstant && folded.constantIndex == (int)constants->size() - 1) constants->pop_back();
+}
+
+// If the expression compiled since offset was a literal true or false, drop its code and return its value
+static bool LiteralCondition(int offset, bool *value)
+{
+    ConstantExpression c;
+    if (!LastExpressionIsConstant(&c) || c.start != offset || !IS_BOOL(c.value)) return false;
+
+    TruncateCode(offset);
+    *value = AS_BOOL(c.value);
+    return true;
+}
+
+// Evaluates l op r the way the VM would. False when the VM would raise an error instead so that
+// still happens at runtime.
+static bool FoldBinaryOp(TokenType op, TValue l, TValue r, TValue *result)
+{
+    if (op == TokenType::EQUAL_EQUAL || op == TokenType::BANG_EQUAL)
+    {
+        bool equal = false;
+        if (IS_NUMBER(l) && IS_NUMBER(r)) equal = AS_NUMBER(l) == AS_NUMBER(r);
+        else if (IS_BOOL(l) && IS_BOOL(r)) equal = AS_BOOL(l) == AS_BOOL(r);
+        else if (RCOBJ_IS_STRING(l) && RCOBJ_IS_STRING(r)) equal = RCStringEquals(RCOBJ_AS_STRING(l), RCOBJ_AS_STRING(r));
+        else if (TVALUE_TYPE(l) == TVALUE_TYPE(r)) return false;
+        *result = BOOL_VAL(op == TokenType::EQUAL_EQUAL ? equal : !equal);
+        return true;
+    }
+
+    if (op == TokenType::PLUS && RCOBJ_IS_STRING(l) && RCOBJ_IS_STRING(r))
+    {
+        RCString *ls = RCOBJ_AS_STRING(l);
+        RCString *rs = RCOBJ_AS_STRING(r);
+        int length = (int)(ls->length + rs->length);
+        char *chars = (char*)malloc(length + 1);
+        memcpy(chars, ls->chars, ls->length);
+        memcpy(chars + ls->length, rs->chars, rs->length);
+        *result = RCOBJ_VAL((RCObject*)CopyString(chars, length, true));
+        free(chars);
+        return true;
+    }
+
+    if (!IS_NUMBER(l) || !IS_NUMBER(r)) return false;
+
+    double a = AS_NUMBER(l);
+    double b = AS_NUMBER(r);
+    switch (op)
+    {
+        case TokenType::PLUS:           *result = NUMBER_VAL(a + b); return true;
+        case TokenType::MINUS:          *result = NUMBER_VAL(a - b); return true;
+        case TokenType::ASTERISK:       *result = NUMBER_VAL(a * b); return true;
+        case TokenType::FORWARDSLASH:   *result = NUMBER_VAL(a / b); return true;
+        case TokenType::GREATER:        *result = BOOL_VAL(a > b); return true;
+        case TokenType::LESS:           *result = BOOL_VAL(a < b); return true;
+        // Note(Kevin): >= and <= compile to the negated opposite comparison so NaN gives true
+        case TokenType::GREATER_EQUAL:  *result = BOOL_VAL(!(a < b)); return true;
+        case TokenType::LESS_EQUAL:     *result = BOOL_VAL(!(a > b)); return true;
+        default: return false;
+    }
+}
+
+#ifdef PIPLANG_REGISTER_BACKEND
+static void EmitRegOp(OpCode op, PendingOperand lhs, PendingOperand rhs)
+{
+    if (parser.previewMode) return;
+
+    current->lastRegOp = (int)CurrentChunk()->bytecode->size();
+    EmitByte(op);
+    EmitByte((u8)(lhs.kind | (rhs.kind << 2) | (REG_STACK << 4)));
+    EmitByte(lhs.index);
+    EmitByte(rhs.index);
+    EmitByte(0);
+}
+
+// If the value about to be stored to a local was just produced by a REG_* instruction, write it to
+// the local directly instead of pushing it and emitting SET_LOCAL.
+static bool FuseStoreIntoLastRegOp(u8 localSlot)
+{
+    if (parser.previewMode) return false;
+
+    std::vector<u8> *code = CurrentChunk()->bytecode;
+    int end = (int)code->size();
+    if (current->pending.kind != REG_STACK ||
+        current->lastRegOp != end - 5 ||
+        current->lastJumpTarget == end) // something jumps to the SET_LOCAL and expects a push
+    {
+        return false;
+    }
+
+    code->at(end - 4) |= (u8)(REG_LOCAL << 4);
+    code->at(end - 1) = localSlot;
+    return true;
+}
+#endif
+
 static PipFunction *EndCompiler()
 {
     if (parser.previewMode) PipLangAssert(0);
@@ -314,10 +662,16 @@ static PipFunction *EndCompiler()
 
     PipFunction *fn = current->compilingTo;
 
+    if (!parser.hadError)
+    {
+        PeepholeOptimizeChunk(CurrentChunk());
+    }
+    SealChunk(CurrentChunk());
+
 #ifdef DEBUG_PRINT_CODE
     if (!parser.hadError)
     {
-        DisassembleChunk(CurrentChunk(), fn->name != NULL ? fn->name->text.c_str() : "<pip top-level script>");
+        DisassembleChunk(CurrentChunk(), fn->name != NULL ? fn->name->chars : "<pip top-level script>");
     }
 #endif
 
@@ -343,15 +697,28 @@ static void HashMapLiteral()
     }
 }
 
+static void ArrayLiteral()
+{
+    EmitByte(OpCode::NEW_ARRAY);
+
+    while (!Match(TokenType::RSQBRACK))
+    {
+        Expression();
+        EmitByte(OpCode::ARRAY_APPEND);
+        if (!Check(TokenType::RSQBRACK))
+            Eat(TokenType::COMMA, "Expected ',' between array elements.");
+    }
+}
+
 static void NumberLiteral()
 {
     double value = strtod(parser.previous.start, NULL);
-    EmitConstant(NUMBER_VAL(value));
+    EmitLiteral(NUMBER_VAL(value));
 }
 
 static void StringLiteral()
 {
-    EmitConstant(RCOBJ_VAL((RCObject*)CopyString(parser.previous.start + 1, parser.previous.length - 2, true)));
+    EmitLiteral(RCOBJ_VAL((RCObject*)CopyString(parser.previous.start + 1, parser.previous.length - 2, true)));
 }
 
 static void Expression()
@@ -369,8 +736,23 @@ static void Unary()
 {
     TokenType operatorType = parser.previous.type;
 
+    int operandStart = NextCodeOffset();
     ParsePrecedence(Precedence::UNARY); // Compile the operand
 
+    ConstantExpression operand;
+    if (LastExpressionIsConstant(&operand) && operand.start == operandStart)
+    {
+        bool foldNegate = operatorType == TokenType::MINUS && IS_NUMBER(operand.value);
+        bool foldNot = operatorType == TokenType::BANG && IS_BOOL(operand.value);
+        if (foldNegate || foldNot)
+        {
+            TruncateCode(operandStart);
+            ReleaseFoldedConstant(operand);
+            EmitLiteral(foldNegate ? NUMBER_VAL(-AS_NUMBER(operand.value)) : BOOL_VAL(!AS_BOOL(operand.value)));
+            return;
+        }
+    }
+
     switch (operatorType)
     {
         case TokenType::BANG:  EmitByte(OpCode::LOGICAL_NOT); break;
@@ -386,7 +768,9 @@ static u8 ArgumentList()
         do 
         {
             Expression();
+#ifndef PIPLANG_DEFERRED_RC
             EmitByte(OpCode::INCREMENT_REF_IF_RCOBJ);
+#endif
             if (argc == 255) Error("Can't have more than 255 arguments to a function.");
             ++argc;
         } while (Match(TokenType::COMMA));
@@ -406,8 +790,60 @@ static void BinOp()
 {
     TokenType operatorType = parser.previous.type;
     ParseRule *rule = GetParseRule(operatorType);
+    ConstantExpression lhsConstant;
+    bool lhsIsConstant = LastExpressionIsConstant(&lhsConstant);
+#ifdef PIPLANG_REGISTER_BACKEND
+    // Note(Kevin): Fine to read the lhs local after the rhs is evaluated because expressions can't
+    //              assign to locals. If lhs wasn't pending it's already on the stack underneath rhs.
+    PendingOperand lhs = TakePendingOperand();
+#endif
     ParsePrecedence(Precedence((u8)rule->infixprecedence + 1));
 
+    ConstantExpression rhsConstant;
+    TValue folded;
+    if (lhsIsConstant && LastExpressionIsConstant(&rhsConstant) && rhsConstant.start == lhsConstant.end &&
+        FoldBinaryOp(operatorType, lhsConstant.value, rhsConstant.value, &folded))
+    {
+        TruncateCode(lhsConstant.start);
+        ReleaseFoldedConstant(rhsConstant);
+        ReleaseFoldedConstant(lhsConstant);
+        EmitLiteral(folded);
+        return;
+    }
+
+#ifdef PIPLANG_REGISTER_BACKEND
+    PendingOperand rhs = TakePendingOperand();
+    switch (operatorType)
+    {
+        case TokenType::PLUS:           EmitRegOp(OpCode::REG_ADD, lhs, rhs); break;
+        case TokenType::MINUS:          EmitRegOp(OpCode::REG_SUBTRACT, lhs, rhs); break;
+        case TokenType::ASTERISK:       EmitRegOp(OpCode::REG_MULTIPLY, lhs, rhs); break;
+        case TokenType::FORWARDSLASH:   EmitRegOp(OpCode::REG_DIVIDE, lhs, rhs); break;
+        case TokenType::BANG_EQUAL:
+            EmitRegOp(OpCode::REG_EQUAL, lhs, rhs);
+            EmitByte(OpCode::LOGICAL_NOT);
+            break;
+        case TokenType::EQUAL_EQUAL:
+            EmitRegOp(OpCode::REG_EQUAL, lhs, rhs);
+            break;
+        case TokenType::GREATER:
+            EmitRegOp(OpCode::REG_GREATER, lhs, rhs);
+            break;
+        case TokenType::LESS:
+            EmitRegOp(OpCode::REG_LESSER, lhs, rhs);
+            break;
+        case TokenType::GREATER_EQUAL:
+            EmitRegOp(OpCode::REG_LESSER, lhs, rhs);
+            EmitByte(OpCode::LOGICAL_NOT);
+            break;
+        case TokenType::LESS_EQUAL:
+            EmitRegOp(OpCode::REG_GREATER, lhs, rhs);
+            EmitByte(OpCode::LOGICAL_NOT);
+            break;
+    }
+    return;
+#endif
+
     switch (operatorType)
     {
         case TokenType::PLUS:           EmitByte(OpCode::ADD); break;
@@ -442,13 +878,27 @@ static void BoolLiteral()
 {
     switch (parser.previous.type) 
     {
-        case TokenType::TRUE: EmitByte((u8)OpCode::OP_TRUE); break;
-        case TokenType::FALSE: EmitByte((u8)OpCode::OP_FALSE); break;
+        case TokenType::TRUE: EmitLiteral(BOOL_VAL(true)); break;
+        case TokenType::FALSE: EmitLiteral(BOOL_VAL(false)); break;
     }
 }
 
 static void LogicalAnd()
 {
+    ConstantExpression lhs;
+    if (LastExpressionIsConstant(&lhs) && IS_BOOL(lhs.value))
+    {
+        // true and x is x, false and x is false without evaluating x
+        TruncateCode(lhs.start);
+        ParsePrecedence(Precedence::AND);
+        if (!AS_BOOL(lhs.value))
+        {
+            TruncateCode(lhs.start);
+            EmitLiteral(BOOL_VAL(false));
+        }
+        return;
+    }
+
     int endJump = EmitJump(OpCode::JUMP_IF_FALSE);
 
     EmitByte(OpCode::POP);
@@ -459,6 +909,20 @@ static void LogicalAnd()
 
 static void LogicalOr()
 {
+    ConstantExpression lhs;
+    if (LastExpressionIsConstant(&lhs) && IS_BOOL(lhs.value))
+    {
+        // false or x is x, true or x is true without evaluating x
+        TruncateCode(lhs.start);
+        ParsePrecedence(Precedence::OR);
+        if (AS_BOOL(lhs.value))
+        {
+            TruncateCode(lhs.start);
+            EmitLiteral(BOOL_VAL(true));
+        }
+        return;
+    }
+
     int elseJump = EmitJump(OpCode::JUMP_IF_FALSE);
     int endJump = EmitJump(OpCode::JUMP);
     PatchJump(elseJump); // go here to check rest of predicate if False
@@ -515,17 +979,18 @@ static void NamedVariable(Token name)
 
     if (localIndexResolved == -1)
     {
-        u32 arg = IdentifierConstant(&name);
-        EmitByte(OpCode::GET_GLOBAL);
-        EmitByte((u8)(arg >> 16));
-        EmitByte((u8)(arg >> 8));
-        EmitByte((u8)(arg));
+        EmitIndexedOp(OpCode::GET_GLOBAL, IdentifierConstant(&name));
+        EmitBytes(0, 0); // inline cache: vm.globals slot hint, filled in by the VM
     }
     else
     {
         u8 arg = (u8)localIndexResolved;
+#ifdef PIPLANG_REGISTER_BACKEND
+        SetPendingOperand(REG_LOCAL, arg);
+#else
         EmitByte(OpCode::GET_LOCAL);
         EmitByte(arg);
+#endif
     }
 }
 
@@ -535,6 +1000,14 @@ static void Variable()
     NamedVariable(parser.previous);
 }
 
+static void EmitFieldOp(OpCode op, Token *field)
+{
+    if (parser.previewMode) return;
+
+    EmitIndexedOp(op, IdentifierConstant(field));
+    EmitBytes(0, 0); // inline cache: slot hint, filled in by the VM
+}
+
 static void Dot()
 {
     Eat(TokenType::IDENTIFIER, "Expected map entry name after '.'.");
@@ -559,7 +1032,10 @@ static void Dot()
         }
         else if (str == "append")
         {
-
+            Eat(TokenType::LPAREN, "Expected '(' after 'append' contextual keyword.");
+            Expression();
+            Eat(TokenType::RPAREN, "Expected ')' after Value expression of 'append' contextual keyword.");
+            EmitByte(OpCode::ARRAY_APPEND);
         }
         else if (str == "remove")
         {
@@ -571,12 +1047,24 @@ static void Dot()
     }
     else
     {
-        // Otherwise GET_MAP_ENTRY
-        EmitConstant(RCOBJ_VAL((RCObject *)CopyString(id.start, id.length, true)));
-        EmitByte(OpCode::GET_MAP_ENTRY);
+        // Otherwise GET_FIELD
+        EmitFieldOp(OpCode::GET_FIELD, &id);
     }
 }
 
+static void Index()
+{
+    Expression();
+    Eat(TokenType::RSQBRACK, "Expected ']' after index expression.");
+
+    if (Check(TokenType::EQUAL))
+    {
+        return; // then Assignment Effect
+    }
+
+    EmitByte(OpCode::GET_INDEX);
+}
+
 
 static void Effect();
 static void Statement();
@@ -620,8 +1108,25 @@ static void IfStatement()
     if (parser.previewMode) PipLangAssert(0);
 
     Eat(TokenType::LPAREN, "Expected '(' after 'if'.");
+    int predicateStart = NextCodeOffset();
     Expression();
     Eat(TokenType::RPAREN, "Expected ')' after predicate.");
+
+    bool predicate;
+    if (LiteralCondition(predicateStart, &predicate))
+    {
+        // Note(Kevin): the arm that can't run is still compiled so its errors get reported, then dropped
+        int deadStart = NextCodeOffset();
+        Statement(); // if-body Block
+        if (!predicate) TruncateCode(deadStart);
+        if (Match(TokenType::ELSE))
+        {
+            deadStart = NextCodeOffset();
+            Statement(); // else-body Block
+            if (predicate) TruncateCode(deadStart);
+        }
+        return;
+    }
     
     int thenJump = EmitJump(OpCode::JUMP_IF_FALSE);
     
@@ -643,10 +1148,19 @@ static void WhileStatement()
     if (parser.previewMode) PipLangAssert(0);
 
     Eat(TokenType::LPAREN, "Expected '(' after keyword 'while'.");
-    int loopStart = (int)CurrentChunk()->bytecode->size();
+    int loopStart = LoopStart();
     Expression();
     Eat(TokenType::RPAREN, "Expected ')' after while-loop predicate.");
 
+    bool predicate;
+    if (LiteralCondition(loopStart, &predicate))
+    {
+        Statement(); // while-body Block
+        if (predicate) EmitLoop(loopStart);
+        else TruncateCode(loopStart);
+        return;
+    }
+
     int exitJump = EmitJump(OpCode::JUMP_IF_FALSE);
     EmitByte(OpCode::POP);
     Statement(); // while-body Block
@@ -675,7 +1189,7 @@ static void ForStatement()
         Effect();
     }
     Eat(TokenType::COMMA, "Expected ','.");
-    int loopStart = (int)CurrentChunk()->bytecode->size();
+    int loopStart = LoopStart();
     int exitJump = -1;
     if (!Match(TokenType::COMMA))
     {
@@ -757,6 +1271,15 @@ static void Effect() // Stack effect = 0
 
         Expression();
 
+        if (parser.previous.type == TokenType::RSQBRACK) // set array element
+        {
+            PipLangAssert(Match(TokenType::EQUAL));
+            Expression();
+            EmitByte(OpCode::SET_INDEX);
+            EmitByte(OpCode::POP);
+            return;
+        }
+
         if (parser.previous.type != TokenType::IDENTIFIER)
         {
             ErrorAtCurrent("Left of assignment operator must be an identifier.");
@@ -765,10 +1288,9 @@ static void Effect() // Stack effect = 0
         if (parser.previousprevious.type == TokenType::DOT) // set map entry
         {
             Token id = parser.previous;
-            EmitConstant(RCOBJ_VAL((RCObject *)CopyString(id.start, id.length, true)));
             PipLangAssert(Match(TokenType::EQUAL));
             Expression();
-            EmitByte(OpCode::SET_MAP_ENTRY);
+            EmitFieldOp(OpCode::SET_FIELD, &id);
             EmitByte(OpCode::POP);
         }
         else // set local or global var
@@ -782,10 +1304,8 @@ static void Effect() // Stack effect = 0
                 PipLangAssert(Match(TokenType::EQUAL));
                 Expression();
 
-                EmitByte(OpCode::SET_GLOBAL);
-                EmitByte((u8)(arg >> 16));
-                EmitByte((u8)(arg >> 8));
-                EmitByte((u8)(arg));
+                EmitIndexedOp(OpCode::SET_GLOBAL, arg);
+                EmitBytes(0, 0); // inline cache: vm.globals slot hint, filled in by the VM
             }
             else
             {
@@ -794,6 +1314,9 @@ static void Effect() // Stack effect = 0
                 PipLangAssert(Match(TokenType::EQUAL));
                 Expression();
 
+#ifdef PIPLANG_REGISTER_BACKEND
+                if (FuseStoreIntoLastRegOp(arg)) return;
+#endif
                 EmitByte(OpCode::SET_LOCAL);
                 EmitByte(arg);
             }
@@ -906,11 +1429,7 @@ static void DefineVariable(u32 global)
         return;
     }
 
-    // TODO(Kevin): Optimize by using LONG op if first 24 bits are non zero or just use u8 and limit max global varibles to 256
-    EmitByte(OpCode::DEFINE_GLOBAL);
-    EmitByte((u8)(global >> 16));
-    EmitByte((u8)(global >> 8));
-    EmitByte((u8)(global));
+    EmitIndexedOp(OpCode::DEFINE_GLOBAL, global);
 }
 
 static void ParseVariableDeclaration()
@@ -922,11 +1441,17 @@ static void ParseVariableDeclaration()
     if (Match(TokenType::EQUAL))
     {
         Expression();
+#ifndef PIPLANG_DEFERRED_RC
         if (current->scopeDepth > 0)
         {
             // check if result of expression is RCOBJ, then increment its ref
             EmitByte(OpCode::INCREMENT_REF_IF_RCOBJ);
         }
+#endif
+#ifdef PIPLANG_REGISTER_BACKEND
+        // a local lives in the stack slot its initializer pushes, so the initializer can't stay pending
+        FlushPendingOperand();
+#endif
     }
     else
     {
@@ -966,11 +1491,7 @@ static void Function(CompilingToType compilingToType)
 
     PipFunction *fn = EndCompiler();
 
-    u32 arg = AddConstant(CurrentChunk(), FUNCTION_VAL(fn));
-    EmitByte(OpCode::CONSTANT_LONG);
-    EmitByte((u8)(arg >> 16));
-    EmitByte((u8)(arg >> 8));
-    EmitByte((u8)(arg));
+    EmitIndexedOp(OpCode::CONSTANT, AddConstant(CurrentChunk(), FUNCTION_VAL(fn)));
 }
 
 static void ParseFunctionDeclaration()
@@ -1004,7 +1525,7 @@ static void Declaration()
 }
 
 
-ParseRule rules[(u8)TokenType::END_OF_FILE];
+ParseRule rules[(u8)TokenType::END_OF_FILE + 1];
 
 void SetupParsingRules()
 {
@@ -1016,7 +1537,7 @@ void SetupParsingRules()
     rules[(u8)TokenType::BANG_EQUAL]        = {          NULL,        BinOp, Precedence::EQUALITY };
     rules[(u8)TokenType::EQUAL_EQUAL]       = {          NULL,        BinOp, Precedence::EQUALITY };
     rules[(u8)TokenType::BANG]              = {         Unary,         NULL, Precedence::NONE };
-    rules[(u8)TokenType::LSQBRACK]          = {  /*ArrayLiteral*/NULL,  /*AccessAorM*/NULL, Precedence::NONE /*CALL probably*/ };
+    rules[(u8)TokenType::LSQBRACK]          = {  ArrayLiteral,        Index, Precedence::CALL };
     rules[(u8)TokenType::RSQBRACK]          = {          NULL,         NULL, Precedence::NONE };
     rules[(u8)TokenType::LPAREN]            = {      Grouping,         Call, Precedence::CALL };
     rules[(u8)TokenType::RPAREN]            = {          NULL,         NULL, Precedence::NONE };
@@ -1073,30 +1594,6 @@ static ParseRule *GetParseRule(TokenType type)
     return &rules[(u8)type];
 }
 
-static void TokenizeAll(const char *source)
-{
-    InitScanner(source);
-
-    for (int i = 0; i < 4096/*TODO(Kevin): too few*/; ++i)
-    {
-        Token t = ScanToken();
-
-        if (t.type == TokenType::ERROR)
-        {
-            ErrorAt(&t, t.start);
-            break;
-        }
-
-        tokensequence.tokens[i] = t;
-
-        if (t.type == TokenType::END_OF_FILE)
-        {
-            tokensequence.numTokens = i + 1;
-            break;
-        }
-    }
-}
-
 PipFunction *Compile(const char *source)
 {
     tokensequence.Allocate();
@@ -1105,8 +1602,7 @@ PipFunction *Compile(const char *source)
 
     parser.hadError = false;
     parser.panicMode = false;
-    TokenizeAll(source);
-    if (parser.hadError) return NULL;
+    InitScanner(source);
 
     Compiler compiler;
     InitCompiler(&compiler, CompilingToType::TOPLEVELSCRIPT);
@@ -1119,7 +1615,6 @@ PipFunction *Compile(const char *source)
     }
 
     PipFunction *toplevelscriptfn = EndCompiler();
-    return parser.hadError ? NULL : toplevelscriptfn;
-
     tokensequence.Free();
+    return parser.hadError ? NULL : toplevelscriptfn;
 }
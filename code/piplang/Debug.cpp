@@ -10,7 +10,7 @@ static void PrintFunction(PipFunction *fn)
         printf("<pip top-level script>");
         return;
     }
-    printf("<fn %s>", fn->name->text.c_str());
+    printf("<fn %s>", fn->name->chars);
 }
 
 static void PrintRCObject(TValue value)
@@ -18,19 +18,31 @@ static void PrintRCObject(TValue value)
     switch (RCOBJ_TYPE(value))
     {
         case RCObject::STRING:
-            printf("%s", RCOBJ_AS_STRING(value)->text.c_str());
+            printf("%.*s", (int)RCOBJ_AS_STRING(value)->length, RCStringChars(RCOBJ_AS_STRING(value)));
             break;
         case RCObject::MAP:
             // entries include tombstones
             printf("<map{%d entries}", RCOBJ_AS_MAP(value)->count);
             printf(" : %d ref>", AS_RCOBJ(value)->refCount);
             break;
+        case RCObject::ARRAY:
+            printf("<array[%d]", RCOBJ_AS_ARRAY(value)->count);
+            printf(" : %d ref>", AS_RCOBJ(value)->refCount);
+            break;
+        case RCObject::BUFFER:
+        {
+            static const char *elementTypeNames[] = { "f32", "i32", "u8" };
+            PipBuffer *buffer = RCOBJ_AS_BUFFER(value);
+            printf("<%s buffer[%d]", elementTypeNames[buffer->elementType], buffer->count);
+            printf(" : %d ref>", AS_RCOBJ(value)->refCount);
+            break;
+        }
     }
 }
 
 void PrintTValue(TValue value)
 {
-    switch (value.type)
+    switch (TVALUE_TYPE(value))
     {
         case TValue::BOOLEAN:
             printf(AS_BOOL(value) ? "True" : "False");
@@ -56,55 +68,81 @@ static int Debug_SimpleInstruction(const char *name, int offset)
     return offset + 1;
 }
 
-static int Debug_ConstantInstruction(const char *name, Chunk *chunk, int offset)
+// width is how many bytes the constant index takes, 1 for X, 2 for X_WIDE and 3 for X_LONG
+static int Debug_ConstantInstruction(const char *name, int width, Chunk *chunk, int offset)
 {
-    u8 constantIndex = chunk->bytecode->at(offset + 1);
+    u32 constantIndex = 0;
+    for (int i = 1; i <= width; ++i) constantIndex = constantIndex << 8 | chunk->code[offset + i];
     printf("%-16s %4d '", name, constantIndex);
-    PrintTValue(chunk->constants->at(constantIndex));
+    PrintTValue(chunk->constantTable[constantIndex]);
     printf("'\n");
-    return offset + 2;
+    return offset + 1 + width;
 }
 
-static int Debug_ConstantLongInstruction(const char *name, Chunk *chunk, int offset)
+static int Debug_CachedMapInstruction(const char *name, int width, Chunk *chunk, int offset)
 {
-    u32 byte2 = chunk->bytecode->at(offset + 1);
-    u32 byte1 = chunk->bytecode->at(offset + 2);
-    u32 byte0 = chunk->bytecode->at(offset + 3);
-    u32 constantIndex = byte2 << 16 | byte1 << 8 | byte0;
-    printf("%-16s %4d '", name, constantIndex);
-    PrintTValue(chunk->constants->at(constantIndex));
-    printf("'\n");
-    return offset + 4;
+    offset = Debug_ConstantInstruction(name, width, chunk, offset);
+    u16 slotHint = (u16)(chunk->code[offset] << 8 | chunk->code[offset + 1]);
+    printf("%-16s %4s (slot hint %d)\n", "", "", slotHint);
+    return offset + 2;
 }
 
 static int Debug_ByteInstruction(const char *name, Chunk *chunk, int offset)
 {
-    u8 byte = chunk->bytecode->at(offset + 1);
+    u8 byte = chunk->code[offset + 1];
     printf("%-16s %4d\n", name, byte);
     return offset + 2;
 }
 
 static int Debug_JumpInstruction(const char *name, int sign, Chunk *chunk, int offset) {
-    u16 jump = (u16)(chunk->bytecode->at(offset + 1) << 8);
-    jump |= chunk->bytecode->at(offset + 2);
+    u16 jump = (u16)(chunk->code[offset + 1] << 8);
+    jump |= chunk->code[offset + 2];
     printf("%-16s %4d -> %d\n", name, offset, offset + 3 + sign * jump);
     return offset + 3;
 }
 
+static void Debug_PrintRegOperand(u8 kind, u8 index, Chunk *chunk)
+{
+    switch (kind)
+    {
+        case REG_STACK: printf("stack"); break;
+        case REG_LOCAL: printf("local[%d]", index); break;
+        case REG_CONST:
+            printf("'");
+            PrintTValue(chunk->constantTable[index]);
+            printf("'");
+            break;
+    }
+}
+
+static int Debug_RegInstruction(const char *name, Chunk *chunk, int offset)
+{
+    u8 mode = chunk->code[offset + 1];
+    printf("%-16s ", name);
+    Debug_PrintRegOperand(mode & 3, chunk->code[offset + 2], chunk);
+    printf(", ");
+    Debug_PrintRegOperand((mode >> 2) & 3, chunk->code[offset + 3], chunk);
+    printf(" -> ");
+    Debug_PrintRegOperand(mode >> 4, chunk->code[offset + 4], chunk);
+    printf("\n");
+    return offset + 5;
+}
+
 int DisassembleInstruction(Chunk *chunk, int offset)
 {
     printf("%04d ", offset);
 
-    if (offset > 0 && chunk->linenumbers->at(offset) == chunk->linenumbers->at(offset - 1))
+    int line = GetLine(chunk, offset);
+    if (offset > 0 && line == GetLine(chunk, offset - 1))
     {
         printf("   | ");
     }
     else
     {
-        printf("%4d ", chunk->linenumbers->at(offset));
+        printf("%4d ", line);
     }
 
-    OpCode instruction = (OpCode)chunk->bytecode->at(offset);
+    OpCode instruction = (OpCode)chunk->code[offset];
     switch (instruction)
     {
     case OpCode::RETURN:
@@ -112,9 +150,11 @@ int DisassembleInstruction(Chunk *chunk, int offset)
     case OpCode::PRINT:
         return Debug_SimpleInstruction("PRINT", offset);
     case OpCode::CONSTANT:
-        return Debug_ConstantInstruction("CONSTANT", chunk, offset);
+        return Debug_ConstantInstruction("CONSTANT", 1, chunk, offset);
+    case OpCode::CONSTANT_WIDE:
+        return Debug_ConstantInstruction("CONSTANT_WIDE", 2, chunk, offset);
     case OpCode::CONSTANT_LONG:
-        return Debug_ConstantLongInstruction("CONSTANT_LONG", chunk, offset);
+        return Debug_ConstantInstruction("CONSTANT_LONG", 3, chunk, offset);
     case OpCode::NEGATE:
         return Debug_SimpleInstruction("NEGATE", offset);
     case OpCode::ADD:
@@ -142,11 +182,23 @@ int DisassembleInstruction(Chunk *chunk, int offset)
     case OpCode::POP_LOCAL:
         return Debug_SimpleInstruction("POP_LOCAL", offset);
     case OpCode::DEFINE_GLOBAL:
-        return Debug_ConstantLongInstruction("DEFINE_GLOBAL", chunk, offset);
+        return Debug_ConstantInstruction("DEFINE_GLOBAL", 1, chunk, offset);
+    case OpCode::DEFINE_GLOBAL_WIDE:
+        return Debug_ConstantInstruction("DEFINE_GLOBAL_WIDE", 2, chunk, offset);
+    case OpCode::DEFINE_GLOBAL_LONG:
+        return Debug_ConstantInstruction("DEFINE_GLOBAL_LONG", 3, chunk, offset);
     case OpCode::GET_GLOBAL:
-        return Debug_ConstantLongInstruction("GET_GLOBAL", chunk, offset);
+        return Debug_CachedMapInstruction("GET_GLOBAL", 1, chunk, offset);
+    case OpCode::GET_GLOBAL_WIDE:
+        return Debug_CachedMapInstruction("GET_GLOBAL_WIDE", 2, chunk, offset);
+    case OpCode::GET_GLOBAL_LONG:
+        return Debug_CachedMapInstruction("GET_GLOBAL_LONG", 3, chunk, offset);
     case OpCode::SET_GLOBAL:
-        return Debug_ConstantLongInstruction("SET_GLOBAL", chunk, offset);
+        return Debug_CachedMapInstruction("SET_GLOBAL", 1, chunk, offset);
+    case OpCode::SET_GLOBAL_WIDE:
+        return Debug_CachedMapInstruction("SET_GLOBAL_WIDE", 2, chunk, offset);
+    case OpCode::SET_GLOBAL_LONG:
+        return Debug_CachedMapInstruction("SET_GLOBAL_LONG", 3, chunk, offset);
     case OpCode::GET_LOCAL:
         return Debug_ByteInstruction("GET_LOCAL", chunk, offset);
     case OpCode::SET_LOCAL:
@@ -169,6 +221,74 @@ int DisassembleInstruction(Chunk *chunk, int offset)
         return Debug_SimpleInstruction("GET_MAP_ENTRY", offset);
     case OpCode::DEL_MAP_ENTRY:
         return Debug_SimpleInstruction("DEL_MAP_ENTRY", offset);
+    case OpCode::NEW_ARRAY:
+        return Debug_SimpleInstruction("NEW_ARRAY", offset);
+    case OpCode::ARRAY_APPEND:
+        return Debug_SimpleInstruction("ARRAY_APPEND", offset);
+    case OpCode::GET_INDEX:
+        return Debug_SimpleInstruction("GET_INDEX", offset);
+    case OpCode::SET_INDEX:
+        return Debug_SimpleInstruction("SET_INDEX", offset);
+    case OpCode::REG_ADD:
+        return Debug_RegInstruction("REG_ADD", chunk, offset);
+    case OpCode::REG_SUBTRACT:
+        return Debug_RegInstruction("REG_SUBTRACT", chunk, offset);
+    case OpCode::REG_MULTIPLY:
+        return Debug_RegInstruction("REG_MULTIPLY", chunk, offset);
+    case OpCode::REG_DIVIDE:
+        return Debug_RegInstruction("REG_DIVIDE", chunk, offset);
+    case OpCode::REG_EQUAL:
+        return Debug_RegInstruction("REG_EQUAL", chunk, offset);
+    case OpCode::REG_GREATER:
+        return Debug_RegInstruction("REG_GREATER", chunk, offset);
+    case OpCode::REG_LESSER:
+        return Debug_RegInstruction("REG_LESSER", chunk, offset);
+    case OpCode::ADD_LOCAL_CONST:
+    {
+        u8 src = chunk->code[offset + 1];
+        u8 constantIndex = chunk->code[offset + 2];
+        u8 dst = chunk->code[offset + 3];
+        printf("%-16s %4d '", "ADD_LOCAL_CONST", src);
+        PrintTValue(chunk->constantTable[constantIndex]);
+        printf("' -> %d\n", dst);
+        return offset + 4;
+    }
+    case OpCode::INDEX_LOCAL_CONST:
+    {
+        u8 array = chunk->code[offset + 1];
+        u8 constantIndex = chunk->code[offset + 2];
+        printf("%-16s %4d ['", "INDEX_LOCAL_CONST", array);
+        PrintTValue(chunk->constantTable[constantIndex]);
+        printf("']\n");
+        return offset + 3;
+    }
+    case OpCode::INDEX_LOCAL_LOCAL:
+    {
+        u8 array = chunk->code[offset + 1];
+        u8 index = chunk->code[offset + 2];
+        printf("%-16s %4d [local %d]\n", "INDEX_LOCAL_LOCAL", array, index);
+        return offset + 3;
+    }
+    case OpCode::NOT_EQUAL:
+        return Debug_SimpleInstruction("NOT_EQUAL", offset);
+    case OpCode::GREATER_EQUAL:
+        return Debug_SimpleInstruction("GREATER_EQUAL", offset);
+    case OpCode::LESSER_EQUAL:
+        return Debug_SimpleInstruction("LESSER_EQUAL", offset);
+    case OpCode::GET_FIELD:
+        return Debug_CachedMapInstruction("GET_FIELD", 1, chunk, offset);
+    case OpCode::GET_FIELD_WIDE:
+        return Debug_CachedMapInstruction("GET_FIELD_WIDE", 2, chunk, offset);
+    case OpCode::GET_FIELD_LONG:
+        return Debug_CachedMapInstruction("GET_FIELD_LONG", 3, chunk, offset);
+    case OpCode::SET_FIELD:
+        return Debug_CachedMapInstruction("SET_FIELD", 1, chunk, offset);
+    case OpCode::SET_FIELD_WIDE:
+        return Debug_CachedMapInstruction("SET_FIELD_WIDE", 2, chunk, offset);
+    case OpCode::SET_FIELD_LONG:
+        return Debug_CachedMapInstruction("SET_FIELD_LONG", 3, chunk, offset);
+    case OpCode::JUMP_IF_FALSE_POP:
+        return Debug_JumpInstruction("JUMP_IF_FALSE_POP", 1, chunk, offset);
     default:
         printf("Unknown opcode %d\n", instruction);
         return offset + 1;
@@ -179,7 +299,7 @@ void DisassembleChunk(Chunk *chunk, const char *name)
 {
     printf("== %s ==\n", name);
 
-    for (int offset = 0; offset < chunk->bytecode->size();)
+    for (int offset = 0; offset < chunk->codeSize;)
     {
         offset = DisassembleInstruction(chunk, offset);
     }
@@ -1,9 +1,206 @@
 #include "Object.h"
 #include "VM.h"
+#include "BufferMath.h"
+#include "../MemoryAllocator.h"
+
+#include <cstddef>
+#include <new>
+#include <unordered_map>
 
 
 #define MAX_LOADFACTOR 0.7
 
+// Note(Kevin): RCStrings, HashMaps, PipArrays, PipBuffers and HashMapEntry arrays come out of slab pools. A script that
+//              builds a few maps every tick ends up reusing the blocks freed the tick before instead of
+//              going to the system allocator each time. Entry arrays are pooled per power of two capacity
+//              from 8 up to 256 entries; anything bigger is calloc'd. Strings carry their characters inline
+//              and are pooled by total size, 64, 128 or 256 bytes; anything bigger is malloc'd. A PipArray's
+//              values are realloc'd since arrays mostly grow by appending. A PipBuffer's data is calloc'd.
+#define ENTRY_POOL_MIN_CAPACITY_LOG2 3
+#define ENTRY_POOL_CLASSES 6
+#define STRING_POOL_MIN_BYTES_LOG2 6
+#define STRING_POOL_CLASSES 3
+#define POOL_SLAB_BYTES 16384
+
+static MemoryPool stringPools[STRING_POOL_CLASSES];
+static MemoryPool mapPool;
+static MemoryPool arrayPool;
+static MemoryPool bufferPool;
+static MemoryPool entryPools[ENTRY_POOL_CLASSES];
+
+static size_t BlocksPerSlab(size_t blockSize)
+{
+    size_t blocks = POOL_SLAB_BYTES / blockSize;
+    return blocks < 8 ? 8 : blocks;
+}
+
+static void InitObjectPoolsIfNeeded()
+{
+    if (mapPool.blockSize != 0) return;
+
+    for (int i = 0; i < STRING_POOL_CLASSES; ++i)
+    {
+        size_t bytes = (size_t)1 << (i + STRING_POOL_MIN_BYTES_LOG2);
+        MemoryPoolInitialize(&stringPools[i], bytes, BlocksPerSlab(bytes));
+    }
+    MemoryPoolInitialize(&mapPool, sizeof(HashMap), BlocksPerSlab(sizeof(HashMap)));
+    MemoryPoolInitialize(&arrayPool, sizeof(PipArray), BlocksPerSlab(sizeof(PipArray)));
+    MemoryPoolInitialize(&bufferPool, sizeof(PipBuffer), BlocksPerSlab(sizeof(PipBuffer)));
+    for (int i = 0; i < ENTRY_POOL_CLASSES; ++i)
+    {
+        size_t bytes = sizeof(HashMapEntry) << (i + ENTRY_POOL_MIN_CAPACITY_LOG2);
+        MemoryPoolInitialize(&entryPools[i], bytes, BlocksPerSlab(bytes));
+    }
+}
+
+static MemoryPool *EntryPoolForCapacity(int capacity)
+{
+    int sizeClass = 0;
+    while ((1 << (sizeClass + ENTRY_POOL_MIN_CAPACITY_LOG2)) < capacity) ++sizeClass;
+    if (sizeClass >= ENTRY_POOL_CLASSES || (1 << (sizeClass + ENTRY_POOL_MIN_CAPACITY_LOG2)) != capacity) return NULL;
+    return &entryPools[sizeClass];
+}
+
+static size_t StringAllocationSize(u32 inlineLength)
+{
+    return offsetof(RCString, chars) + inlineLength + 1;
+}
+
+static MemoryPool *StringPoolForSize(size_t bytes)
+{
+    for (int i = 0; i < STRING_POOL_CLASSES; ++i)
+    {
+        if (bytes <= stringPools[i].blockSize) return &stringPools[i];
+    }
+    return NULL;
+}
+
+#ifdef PIPLANG_FRAME_ARENA
+
+#define FRAME_ARENA_BYTES (4 * 1024 * 1024)
+#define FRAME_ARENA_FREED_REFCOUNT INT32_MIN // arena memory isn't reused before the reset so mark instead
+
+PipFrameArena frameArena;
+static size_t frameArenaPeakBytes = 0;
+static size_t lastFrameArenaObjects = 0;
+static size_t lastFramePromotedObjects = 0;
+
+// NULL when the arena is inactive or full, the caller falls back to the pools
+static void *FrameArenaAllocate(size_t bytes, size_t align)
+{
+    MemoryLinearBuffer *buffer = &frameArena.buffer;
+    if (!frameArena.active || buffer->arenaOffset + bytes + align > buffer->bufferSize) return NULL;
+    return MemoryLinearAllocate(buffer, bytes, align);
+}
+
+void FrameArenaRememberMap(HashMap *map)
+{
+    map->rememberedByFrameArena = true;
+    frameArena.rememberedMaps.push_back(map);
+}
+
+static void FrameArenaForgetMap(HashMap *map)
+{
+    for (size_t i = 0; i < frameArena.rememberedMaps.size(); ++i)
+    {
+        if (frameArena.rememberedMaps[i] == map)
+        {
+            frameArena.rememberedMaps[i] = frameArena.rememberedMaps.back();
+            frameArena.rememberedMaps.pop_back();
+            break;
+        }
+    }
+    map->rememberedByFrameArena = false;
+}
+
+void FrameArenaRememberArray(PipArray *array)
+{
+    array->rememberedByFrameArena = true;
+    frameArena.rememberedArrays.push_back(array);
+}
+
+static void FrameArenaForgetArray(PipArray *array)
+{
+    for (size_t i = 0; i < frameArena.rememberedArrays.size(); ++i)
+    {
+        if (frameArena.rememberedArrays[i] == array)
+        {
+            frameArena.rememberedArrays[i] = frameArena.rememberedArrays.back();
+            frameArena.rememberedArrays.pop_back();
+            break;
+        }
+    }
+    array->rememberedByFrameArena = false;
+}
+
+#endif // PIPLANG_FRAME_ARENA
+
+static HashMapEntry *AllocateEntries(HashMap *owner, int capacity)
+{
+    InitObjectPoolsIfNeeded();
+#ifdef PIPLANG_FRAME_ARENA
+    if (IsInFrameArena(owner))
+    {
+        void *arenaEntries = FrameArenaAllocate(sizeof(HashMapEntry) * capacity, alignof(HashMapEntry));
+        if (arenaEntries)
+        {
+            memset(arenaEntries, 0, sizeof(HashMapEntry) * capacity);
+            return (HashMapEntry *)arenaEntries;
+        }
+    }
+#endif
+
+    MemoryPool *pool = EntryPoolForCapacity(capacity);
+    if (pool == NULL) return (HashMapEntry *)calloc(capacity, sizeof(HashMapEntry));
+
+    // zeroed like calloc so an empty entry's value reads as BOOLEAN FALSE
+    HashMapEntry *entries = (HashMapEntry *)MemoryPoolAllocate(pool);
+    memset((void*)entries, 0, sizeof(HashMapEntry) * capacity);
+    return entries;
+}
+
+static void FreeEntries(HashMapEntry *entries, int capacity)
+{
+#ifdef PIPLANG_FRAME_ARENA
+    if (IsInFrameArena(entries)) return;
+#endif
+    MemoryPool *pool = EntryPoolForCapacity(capacity);
+    if (pool == NULL) free(entries);
+    else MemoryPoolFree(pool, entries);
+}
+
+PipObjectPoolStats GetPipObjectPoolStats()
+{
+    PipObjectPoolStats stats;
+    for (int i = 0; i < STRING_POOL_CLASSES; ++i)
+    {
+        stats.liveStrings += stringPools[i].liveBlocks;
+        stats.peakStrings += stringPools[i].peakLiveBlocks;
+        stats.slabBytes += stringPools[i].slabCount * stringPools[i].blockSize * stringPools[i].blocksPerSlab;
+    }
+    stats.liveMaps = mapPool.liveBlocks;
+    stats.peakMaps = mapPool.peakLiveBlocks;
+    stats.liveArrays = arrayPool.liveBlocks;
+    stats.peakArrays = arrayPool.peakLiveBlocks;
+    stats.liveBuffers = bufferPool.liveBlocks;
+    stats.peakBuffers = bufferPool.peakLiveBlocks;
+    for (int i = 0; i < ENTRY_POOL_CLASSES; ++i)
+    {
+        stats.liveEntryArrays += entryPools[i].liveBlocks;
+        stats.peakEntryArrays += entryPools[i].peakLiveBlocks;
+        stats.slabBytes += entryPools[i].slabCount * entryPools[i].blockSize * entryPools[i].blocksPerSlab;
+    }
+    stats.slabBytes += mapPool.slabCount * mapPool.blockSize * mapPool.blocksPerSlab;
+    stats.slabBytes += arrayPool.slabCount * arrayPool.blockSize * arrayPool.blocksPerSlab;
+    stats.slabBytes += bufferPool.slabCount * bufferPool.blockSize * bufferPool.blocksPerSlab;
+#ifdef PIPLANG_FRAME_ARENA
+    stats.frameArenaPeakBytes = frameArenaPeakBytes;
+    stats.lastFrameArenaObjects = lastFrameArenaObjects;
+    stats.lastFramePromotedObjects = lastFramePromotedObjects;
+#endif
+    return stats;
+}
+
 static RCString *HashMapFindString(HashMap *map, const char *buf, int length, u32 hash)
 {
     if (map->count == 0) return NULL;
@@ -17,7 +214,7 @@ static RCString *HashMapFindString(HashMap *map, const char *buf, int length, u3
             // Check if empty non-tombstone entry
             if (!AS_BOOL(entry->value)) return NULL;
         }
-        else if (entry->key->hash == hash && entry->key->text == std::string(buf, length))
+        else if (entry->key->hash == hash && entry->key->length == (u32)length && memcmp(entry->key->chars, buf, length) == 0)
         {
             return entry->key;
         }
@@ -55,8 +252,7 @@ static HashMapEntry *FindEntry(HashMapEntry *entries, int capacity, RCString *ke
 
 static void AdjustCapacity(HashMap *map, int newCapacity)
 {
-    HashMapEntry *entries = (HashMapEntry *)calloc(newCapacity, sizeof(HashMapEntry));
-    // calloc-ed so empty entry's value is BOOLEAN FALSE
+    HashMapEntry *entries = AllocateEntries(map, newCapacity);
 
     map->count = 0;
     for (int i = 0; i < map->capacity; ++i)
@@ -68,7 +264,7 @@ static void AdjustCapacity(HashMap *map, int newCapacity)
         dest->value = entry->value;
         ++map->count;
     }
-    if (map->entries != NULL) free(map->entries);
+    if (map->entries != NULL) FreeEntries(map->entries, map->capacity);
 
     map->entries = entries;
     map->capacity = newCapacity;
@@ -82,12 +278,160 @@ void AllocateHashMap(HashMap *map)
 
 void FreeHashMap(HashMap *map)
 {
-    free(map->entries);
+    if (map->entries != NULL) FreeEntries(map->entries, map->capacity);
     *map = HashMap();
 }
 
+void ArrayAppend(PipArray *array, TValue value)
+{
+#ifdef PIPLANG_FRAME_ARENA
+    FrameArenaNoteStore(array, value);
+#endif
+    if (array->count == array->capacity)
+    {
+        array->capacity = array->capacity < 8 ? 8 : array->capacity * 2;
+        array->values = (TValue *)realloc(array->values, sizeof(TValue) * array->capacity);
+    }
+    array->values[array->count++] = value;
+}
+
+TValue ArrayRemoveAt(PipArray *array, int index)
+{
+    TValue removed = array->values[index];
+    memmove(array->values + index, array->values + index + 1, sizeof(TValue) * (array->count - index - 1));
+    --array->count;
+    return removed;
+}
+
+void FreeArray(PipArray *array)
+{
+    free(array->values);
+    array->values = NULL;
+    array->count = 0;
+    array->capacity = 0;
+}
+
+PipBuffer *NewBuffer(PipBuffer::ElementType elementType, int count)
+{
+    static const size_t elementSize[] = { sizeof(float), sizeof(i32), sizeof(u8) };
+    PipBuffer *buffer = (PipBuffer*)NewRCObject(RCObject::BUFFER);
+    buffer->elementType = elementType;
+    buffer->count = count;
+    buffer->data = count > 0 ? calloc(count, elementSize[elementType]) : NULL;
+    return buffer;
+}
+
+static inline i32 ToI32(double value)
+{
+    if (!(value > -2147483648.0)) return value != value ? 0 : INT32_MIN; // NaN reads as 0
+    if (value >= 2147483647.0) return INT32_MAX;
+    return (i32)value;
+}
+
+static inline u8 ToU8(double value)
+{
+    if (!(value > 0.0)) return 0;
+    if (value >= 255.0) return 255;
+    return (u8)value;
+}
+
+void BufferSet(PipBuffer *buffer, int index, double value)
+{
+    switch (buffer->elementType)
+    {
+        case PipBuffer::F32: ((float*)buffer->data)[index] = (float)value; break;
+        case PipBuffer::I32: ((i32*)buffer->data)[index] = ToI32(value); break;
+        case PipBuffer::U8:  ((u8*)buffer->data)[index] = ToU8(value); break;
+    }
+}
+
+// Note(Kevin): the loops below are written per element type over the raw data so the compiler can
+//              vectorize them. Mixed element types fall back to BufferGet/BufferSet. f32 math that doesn't
+//              vectorize on its own goes through BufferMath.
+
+void BufferFill(PipBuffer *buffer, double value)
+{
+    int n = buffer->count;
+    switch (buffer->elementType)
+    {
+        case PipBuffer::F32:
+        {
+            float *d = (float*)buffer->data;
+            float v = (float)value;
+            for (int i = 0; i < n; ++i) d[i] = v;
+            break;
+        }
+        case PipBuffer::I32:
+        {
+            i32 *d = (i32*)buffer->data;
+            i32 v = ToI32(value);
+            for (int i = 0; i < n; ++i) d[i] = v;
+            break;
+        }
+        case PipBuffer::U8:
+            if (n > 0) memset(buffer->data, ToU8(value), n);
+            break;
+    }
+}
+
+void BufferAddScaled(PipBuffer *dst, const PipBuffer *src, double scale)
+{
+    int n = dst->count;
+    if (dst->elementType == PipBuffer::F32 && src->elementType == PipBuffer::F32)
+    {
+        float *d = (float*)dst->data;
+        const float *s = (const float*)src->data;
+        float k = (float)scale;
+        for (int i = 0; i < n; ++i) d[i] += s[i] * k;
+        return;
+    }
+    if (dst->elementType == PipBuffer::I32 && src->elementType == PipBuffer::I32 && scale == 1.0)
+    {
+        i32 *d = (i32*)dst->data;
+        const i32 *s = (const i32*)src->data;
+        for (int i = 0; i < n; ++i)
+        {
+            i64 sum = (i64)d[i] + s[i]; // saturates like BufferSet
+            d[i] = (i32)(sum < INT32_MIN ? INT32_MIN : sum > INT32_MAX ? INT32_MAX : sum);
+        }
+        return;
+    }
+    for (int i = 0; i < n; ++i) BufferSet(dst, i, BufferGet(dst, i) + BufferGet(src, i) * scale);
+}
+
+void BufferClamp(PipBuffer *buffer, double lo, double hi)
+{
+    int n = buffer->count;
+    switch (buffer->elementType)
+    {
+        case PipBuffer::F32:
+            BufferMathF32(BufferMathOp::CLAMP, (float*)buffer->data, (float*)buffer->data, NULL, (float)lo, (float)hi, n);
+            break;
+        case PipBuffer::I32:
+        {
+            i32 *d = (i32*)buffer->data;
+            i32 l = ToI32(lo);
+            i32 h = ToI32(hi);
+            for (int i = 0; i < n; ++i) d[i] = d[i] < l ? l : (d[i] > h ? h : d[i]);
+            break;
+        }
+        case PipBuffer::U8:
+        {
+            u8 *d = (u8*)buffer->data;
+            u8 l = ToU8(lo);
+            u8 h = ToU8(hi);
+            for (int i = 0; i < n; ++i) d[i] = d[i] < l ? l : (d[i] > h ? h : d[i]);
+            break;
+        }
+    }
+}
+
 bool HashMapSet(HashMap *map, RCString *key, TValue value, TValue *replaced)
 {
+#ifdef PIPLANG_FRAME_ARENA
+    // interned_strings doesn't own its keys, FreeRCObject and EndFrameArena keep it up to date instead
+    if (map != &vm.interned_strings) FrameArenaNoteStore(map, key, value);
+#endif
     if ((double)map->count + 1 > (double)map->capacity * MAX_LOADFACTOR)
     {
         AdjustCapacity(map, map->capacity * 2);
@@ -112,6 +456,12 @@ bool HashMapGet(HashMap *map, RCString *key, TValue *value)
     return true;
 }
 
+HashMapEntry *HashMapGetEntry(HashMap *map, RCString *key)
+{
+    HashMapEntry *entry = FindEntry(map->entries, map->capacity, key);
+    return entry->key == NULL ? NULL : entry;
+}
+
 bool HashMapDelete(HashMap *map, RCString *key)
 {
     HashMapEntry *entry = FindEntry(map->entries, map->capacity, key);
@@ -142,26 +492,71 @@ static u32 HashString(const char *key, int length)
     //}
 }
 
-RCObject *NewRCObject(RCObject::OType type)
+// inlineLength chars plus the terminating 0 are allocated right after the header
+static RCString *AllocateString(u32 inlineLength, bool allowFrameArena)
 {
-    RCObject *rcobj = NULL;
+    InitObjectPoolsIfNeeded();
 
-    switch (type)
+    size_t bytes = StringAllocationSize(inlineLength);
+    void *memory = NULL;
+#ifdef PIPLANG_FRAME_ARENA
+    if (allowFrameArena)
     {
-        case RCObject::STRING:
-            rcobj = (RCObject*) new RCString(); // Throw somewhere on heap for now
-            break;
-        case RCObject::MAP:
-            rcobj = (RCObject*) new HashMap();
-            AllocateHashMap((HashMap*)rcobj);
-            break;
+        memory = FrameArenaAllocate(bytes, alignof(RCString));
+        if (memory) frameArena.objects.push_back((RCObject*)memory);
+    }
+#endif
+    if (memory == NULL)
+    {
+        MemoryPool *pool = StringPoolForSize(bytes);
+        memory = pool ? MemoryPoolAllocate(pool) : malloc(bytes);
     }
+    return new (memory) RCString();
+}
+
+static void FreeStringMemory(RCString *str, u32 inlineLength)
+{
+    MemoryPool *pool = StringPoolForSize(StringAllocationSize(inlineLength));
+    if (pool) MemoryPoolFree(pool, str);
+    else free(str);
+}
+
+static RCObject *AllocateRCObject(RCObject::OType type, bool allowFrameArena)
+{
+    if (type == RCObject::STRING) return (RCObject*)AllocateString(0, allowFrameArena);
+
+    InitObjectPoolsIfNeeded();
+    if (type == RCObject::ARRAY) return (RCObject*)new (MemoryPoolAllocate(&arrayPool)) PipArray();
+    if (type == RCObject::BUFFER) return (RCObject*)new (MemoryPoolAllocate(&bufferPool)) PipBuffer();
+
+    void *memory = NULL;
+#ifdef PIPLANG_FRAME_ARENA
+    if (allowFrameArena)
+    {
+        memory = FrameArenaAllocate(sizeof(HashMap), alignof(HashMap));
+        if (memory) frameArena.objects.push_back((RCObject*)memory);
+    }
+#endif
+    if (memory == NULL) memory = MemoryPoolAllocate(&mapPool);
+
+    HashMap *map = new (memory) HashMap();
+    AllocateHashMap(map);
+    return (RCObject*)map;
+}
 
-    return rcobj;
+RCObject *NewRCObject(RCObject::OType type)
+{
+    return AllocateRCObject(type, true);
 }
 
 void FreeRCObject(RCObject *obj)
 {
+#ifdef PIPLANG_FRAME_ARENA
+    bool inFrameArena = IsInFrameArena(obj);
+#else
+    bool inFrameArena = false;
+#endif
+
     switch (obj->type)
     {
         case RCObject::STRING:
@@ -169,22 +564,466 @@ void FreeRCObject(RCObject *obj)
             RCString *str = (RCString*)obj;
             if (!str->isConstant)
             {
-                HashMapDelete(&vm.interned_strings, str);
-                free(obj);
+                u32 inlineLength = str->builder ? 0 : str->length;
+                if (str->builder == NULL) HashMapDelete(&vm.interned_strings, str);
+                str->~RCString();
+                if (!inFrameArena) FreeStringMemory(str, inlineLength);
             }
             break;
         }
         case RCObject::MAP:
         {
             HashMap *map = (HashMap*)obj;
+#ifdef PIPLANG_FRAME_ARENA
+            if (map->rememberedByFrameArena) FrameArenaForgetMap(map);
+#endif
+            bool buffered = obj->gcBuffered; // FreeHashMap resets the header
             FreeHashMap(map);
-            free(obj);
+            if (buffered && !inFrameArena)
+            {
+                // the candidate roots still point at it, CollectCycles frees the header
+                obj->gcBuffered = true;
+                obj->gcColor = RCObject::RELEASED;
+                return;
+            }
+            map->~HashMap();
+            if (!inFrameArena) MemoryPoolFree(&mapPool, map);
+            break;
+        }
+        case RCObject::ARRAY:
+        {
+            PipArray *array = (PipArray*)obj;
+#ifdef PIPLANG_FRAME_ARENA
+            if (array->rememberedByFrameArena) FrameArenaForgetArray(array);
+#endif
+            FreeArray(array);
+            if (obj->gcBuffered)
+            {
+                obj->gcColor = RCObject::RELEASED;
+                return;
+            }
+            array->~PipArray();
+            MemoryPoolFree(&arrayPool, array);
+            break;
+        }
+        case RCObject::BUFFER:
+        {
+            // never a candidate root, see PossibleCycleRoot
+            PipBuffer *buffer = (PipBuffer*)obj;
+            free(buffer->data);
+            buffer->~PipBuffer();
+            MemoryPoolFree(&bufferPool, buffer);
             break;
         }
     }
 
+#ifdef PIPLANG_FRAME_ARENA
+    if (inFrameArena) obj->refCount = FRAME_ARENA_FREED_REFCOUNT;
+#endif
 }
 
+#ifdef PIPLANG_DEFERRED_RC
+std::vector<RCObject*> zeroCountTable;
+#endif
+
+static std::vector<RCObject*> cycleRoots;
+static PipCycleCollectorStats cycleStats;
+
+void BufferPossibleCycleRoot(RCObject *obj)
+{
+    obj->gcColor = RCObject::PURPLE;
+    if (!obj->gcBuffered)
+    {
+        obj->gcBuffered = true;
+        cycleRoots.push_back(obj);
+    }
+}
+
+// Maps and arrays are the only objects that can reference other maps and arrays. Their value slots are
+// walked the same way: a map's by capacity (empty slots and tombstones read as not RCOBJ), an array's by count.
+static inline bool IsContainer(TValue v)
+{
+    return IS_RCOBJ(v) && (AS_RCOBJ(v)->type == RCObject::MAP || AS_RCOBJ(v)->type == RCObject::ARRAY);
+}
+
+static inline int ContainerSlotCount(RCObject *obj)
+{
+    return obj->type == RCObject::MAP ? ((HashMap*)obj)->capacity : ((PipArray*)obj)->count;
+}
+
+static inline TValue ContainerSlot(RCObject *obj, int i)
+{
+    if (obj->type == RCObject::ARRAY) return ((PipArray*)obj)->values[i];
+    HashMapEntry *entry = &((HashMap*)obj)->entries[i];
+    return entry->key ? entry->value : TValue();
+}
+
+// Note(Kevin): the four passes below are the recursive MarkGray/Scan/ScanBlack/CollectWhite from the
+//              paper written with an explicit stack. A long linked list of maps would blow the C stack.
+
+static void MarkGray(RCObject *root, std::vector<RCObject*>& stack)
+{
+    stack.push_back(root);
+    while (!stack.empty())
+    {
+        RCObject *obj = stack.back();
+        stack.pop_back();
+        if (obj->gcColor == RCObject::GRAY) continue;
+        obj->gcColor = RCObject::GRAY;
+        ++cycleStats.lastScanned;
+        int slots = ContainerSlotCount(obj);
+        for (int i = 0; i < slots; ++i)
+        {
+            TValue v = ContainerSlot(obj, i);
+            if (IsContainer(v))
+            {
+                --AS_RCOBJ(v)->refCount;
+                stack.push_back(AS_RCOBJ(v));
+            }
+        }
+    }
+}
+
+static void ScanBlack(RCObject *root, std::vector<RCObject*>& stack)
+{
+    root->gcColor = RCObject::BLACK;
+    stack.push_back(root);
+    while (!stack.empty())
+    {
+        RCObject *obj = stack.back();
+        stack.pop_back();
+        int slots = ContainerSlotCount(obj);
+        for (int i = 0; i < slots; ++i)
+        {
+            TValue v = ContainerSlot(obj, i);
+            if (IsContainer(v))
+            {
+                RCObject *child = AS_RCOBJ(v);
+                ++child->refCount;
+                if (child->gcColor != RCObject::BLACK)
+                {
+                    child->gcColor = RCObject::BLACK;
+                    stack.push_back(child);
+                }
+            }
+        }
+    }
+}
+
+static void Scan(RCObject *root, std::vector<RCObject*>& stack, std::vector<RCObject*>& blackStack)
+{
+    stack.push_back(root);
+    while (!stack.empty())
+    {
+        RCObject *obj = stack.back();
+        stack.pop_back();
+        if (obj->gcColor != RCObject::GRAY) continue;
+        if (obj->refCount > 0)
+        {
+            ScanBlack(obj, blackStack);
+            continue;
+        }
+        obj->gcColor = RCObject::WHITE;
+        int slots = ContainerSlotCount(obj);
+        for (int i = 0; i < slots; ++i)
+        {
+            TValue v = ContainerSlot(obj, i);
+            if (IsContainer(v)) stack.push_back(AS_RCOBJ(v));
+        }
+    }
+}
+
+static void CollectWhite(RCObject *root, std::vector<RCObject*>& stack, std::vector<RCObject*>& garbage)
+{
+    stack.push_back(root);
+    while (!stack.empty())
+    {
+        RCObject *obj = stack.back();
+        stack.pop_back();
+        if (obj->gcColor != RCObject::WHITE) continue;
+        obj->gcColor = RCObject::BLACK;
+        garbage.push_back(obj);
+        int slots = ContainerSlotCount(obj);
+        for (int i = 0; i < slots; ++i)
+        {
+            TValue v = ContainerSlot(obj, i);
+            if (IsContainer(v)) stack.push_back(AS_RCOBJ(v));
+        }
+    }
+}
+
+// A string or buffer referenced by garbage
+static void ReleaseLeaf(RCObject *obj)
+{
+    if (--obj->refCount <= 0) FreeRCObject(obj);
+}
+
+size_t CollectCycles(size_t maxRoots)
+{
+    cycleStats.lastScanned = 0;
+    cycleStats.lastFreed = 0;
+    if (cycleRoots.empty()) return 0;
+    ++cycleStats.collections;
+
+    // Take the batch off the end of the buffer. Candidates outside the batch keep gcBuffered set so if
+    // they turn out to be garbage only their contents are freed here (RELEASED) and not the header.
+    size_t batchSize = maxRoots < cycleRoots.size() ? maxRoots : cycleRoots.size();
+    std::vector<RCObject*> batch(cycleRoots.end() - batchSize, cycleRoots.end());
+    cycleRoots.resize(cycleRoots.size() - batchSize);
+
+    std::vector<RCObject*> stack;
+    std::vector<RCObject*> blackStack;
+
+    // MarkRoots
+    size_t kept = 0;
+    for (RCObject *obj : batch)
+    {
+        if (obj->gcColor == RCObject::PURPLE && obj->refCount > 0)
+        {
+            MarkGray(obj, stack);
+            batch[kept++] = obj;
+            continue;
+        }
+        obj->gcBuffered = false;
+        if (obj->gcColor == RCObject::RELEASED)
+        {
+            if (obj->type == RCObject::MAP)
+            {
+                ((HashMap*)obj)->~HashMap();
+                MemoryPoolFree(&mapPool, obj);
+            }
+            else
+            {
+                ((PipArray*)obj)->~PipArray();
+                MemoryPoolFree(&arrayPool, obj);
+            }
+        }
+        else if (obj->gcColor == RCObject::PURPLE)
+        {
+            obj->gcColor = RCObject::BLACK;
+        }
+    }
+    batch.resize(kept);
+
+    // ScanRoots
+    for (RCObject *obj : batch)
+    {
+        Scan(obj, stack, blackStack);
+    }
+
+    // CollectRoots
+    std::vector<RCObject*> garbage;
+    for (RCObject *obj : batch)
+    {
+        obj->gcBuffered = false;
+        CollectWhite(obj, stack, garbage);
+    }
+
+    // References between garbage objects were already subtracted by MarkGray and references to live maps
+    // and arrays stay subtracted (they're going away), only strings and buffers still need releasing.
+    for (RCObject *obj : garbage)
+    {
+        if (obj->type == RCObject::MAP)
+        {
+            HashMap *map = (HashMap*)obj;
+            for (int i = 0; i < map->capacity; ++i)
+            {
+                HashMapEntry *entry = &map->entries[i];
+                if (entry->key == NULL) continue;
+                ReleaseLeaf((RCObject*)entry->key);
+                if (IS_RCOBJ(entry->value) && !IsContainer(entry->value)) ReleaseLeaf(AS_RCOBJ(entry->value));
+            }
+        }
+        else
+        {
+            PipArray *array = (PipArray*)obj;
+            for (int i = 0; i < array->count; ++i)
+            {
+                if (IS_RCOBJ(array->values[i]) && !IsContainer(array->values[i])) ReleaseLeaf(AS_RCOBJ(array->values[i]));
+            }
+        }
+    }
+    for (RCObject *obj : garbage)
+    {
+        obj->refCount = 0;
+        FreeRCObject(obj);
+    }
+
+    cycleStats.lastFreed = garbage.size();
+    cycleStats.totalScanned += cycleStats.lastScanned;
+    cycleStats.totalFreed += cycleStats.lastFreed;
+    return cycleRoots.size();
+}
+
+PipCycleCollectorStats GetPipCycleCollectorStats()
+{
+    cycleStats.bufferedRoots = cycleRoots.size();
+    return cycleStats;
+}
+
+#ifdef PIPLANG_FRAME_ARENA
+
+void BeginFrameArena()
+{
+    if (frameArena.buffer.buffer == NULL)
+    {
+        MemoryLinearInitialize(&frameArena.buffer, FRAME_ARENA_BYTES);
+    }
+    frameArena.buffer.arenaOffset = 0;
+    frameArena.active = true;
+}
+
+// Copy an arena object to the pools. Its refs are patched by the caller (the one reference being looked
+// at) and by later lookups in forwarded (every other reference). Maps are queued so their entries get
+// looked at too.
+static RCObject *PromoteFrameArenaObject(RCObject *obj, std::unordered_map<RCObject*, RCObject*>& forwarded,
+                                         std::vector<HashMap*>& mapsToScan)
+{
+    auto it = forwarded.find(obj);
+    if (it != forwarded.end()) return it->second;
+
+    RCObject *promoted = NULL;
+    if (obj->type == RCObject::STRING)
+    {
+        RCString *str = (RCString*)obj;
+        u32 inlineLength = str->builder ? 0 : str->length;
+        RCString *heapStr = AllocateString(inlineLength, false);
+        memcpy(heapStr->chars, str->chars, inlineLength + 1);
+        heapStr->hash = str->hash;
+        heapStr->length = str->length;
+        heapStr->isConstant = str->isConstant;
+        heapStr->builder = str->builder;
+        str->builder = NULL;
+        if (heapStr->builder == NULL)
+        {
+            HashMapDelete(&vm.interned_strings, str);
+            HashMapSet(&vm.interned_strings, heapStr, TValue(), NULL);
+        }
+        str->~RCString();
+        promoted = (RCObject*)heapStr;
+    }
+    else
+    {
+        HashMap *map = (HashMap*)obj;
+        HashMap *heapMap = new (MemoryPoolAllocate(&mapPool)) HashMap();
+        heapMap->count = map->count;
+        heapMap->capacity = map->capacity;
+        heapMap->entries = AllocateEntries(heapMap, map->capacity);
+        memcpy(heapMap->entries, map->entries, sizeof(HashMapEntry) * map->capacity);
+        FreeEntries(map->entries, map->capacity);
+        promoted = (RCObject*)heapMap;
+        mapsToScan.push_back(heapMap);
+    }
+    promoted->refCount = obj->refCount;
+
+    forwarded[obj] = promoted;
+    ++lastFramePromotedObjects;
+    return promoted;
+}
+
+static void PromoteIfInFrameArena(TValue *value, std::unordered_map<RCObject*, RCObject*>& forwarded,
+                                  std::vector<HashMap*>& mapsToScan)
+{
+    if (IS_RCOBJ(*value) && IsInFrameArena(AS_RCOBJ(*value)))
+    {
+        *value = RCOBJ_VAL(PromoteFrameArenaObject(AS_RCOBJ(*value), forwarded, mapsToScan));
+    }
+}
+
+static void PromoteEntriesInFrameArena(HashMap *map, std::unordered_map<RCObject*, RCObject*>& forwarded,
+                                       std::vector<HashMap*>& mapsToScan)
+{
+    for (int i = 0; i < map->capacity; ++i)
+    {
+        HashMapEntry *entry = &map->entries[i];
+        if (entry->key == NULL) continue;
+        if (IsInFrameArena(entry->key))
+        {
+            entry->key = (RCString*)PromoteFrameArenaObject((RCObject*)entry->key, forwarded, mapsToScan);
+        }
+        PromoteIfInFrameArena(&entry->value, forwarded, mapsToScan);
+    }
+}
+
+void EndFrameArena(TValue *stackBegin, TValue *stackEnd)
+{
+    frameArena.active = false;
+    lastFrameArenaObjects = frameArena.objects.size();
+    lastFramePromotedObjects = 0;
+    if (frameArena.buffer.arenaOffset > frameArenaPeakBytes) frameArenaPeakBytes = frameArena.buffer.arenaOffset;
+
+    if (!frameArena.objects.empty())
+    {
+        // Arena maps that are candidate roots either get promoted (they're live, the copy isn't buffered)
+        // or dropped with the arena so the collector must not see them again. Same for the zero count table.
+        size_t keptRoots = 0;
+        for (RCObject *obj : cycleRoots)
+        {
+            if (!IsInFrameArena(obj)) cycleRoots[keptRoots++] = obj;
+        }
+        cycleRoots.resize(keptRoots);
+#ifdef PIPLANG_DEFERRED_RC
+        size_t keptZeroCount = 0;
+        for (RCObject *obj : zeroCountTable)
+        {
+            if (!IsInFrameArena(obj)) zeroCountTable[keptZeroCount++] = obj;
+        }
+        zeroCountTable.resize(keptZeroCount);
+#endif
+
+        std::unordered_map<RCObject*, RCObject*> forwarded;
+        std::vector<HashMap*> mapsToScan;
+
+        for (TValue *v = stackBegin; v < stackEnd; ++v)
+        {
+            PromoteIfInFrameArena(v, forwarded, mapsToScan);
+        }
+        for (HashMap *map : frameArena.rememberedMaps)
+        {
+            PromoteEntriesInFrameArena(map, forwarded, mapsToScan);
+        }
+        for (PipArray *array : frameArena.rememberedArrays)
+        {
+            for (int i = 0; i < array->count; ++i)
+            {
+                PromoteIfInFrameArena(&array->values[i], forwarded, mapsToScan);
+            }
+        }
+        while (!mapsToScan.empty())
+        {
+            HashMap *map = mapsToScan.back();
+            mapsToScan.pop_back();
+            PromoteEntriesInFrameArena(map, forwarded, mapsToScan);
+        }
+
+        // Whatever is left and not freed is unreachable from outside the arena (leaked refcounts or a map
+        // cycle). Drop it with the arena but take strings out of interned_strings first.
+        for (RCObject *obj : frameArena.objects)
+        {
+            if (obj->refCount == FRAME_ARENA_FREED_REFCOUNT || forwarded.count(obj)) continue;
+            if (obj->type == RCObject::STRING)
+            {
+                RCString *str = (RCString*)obj;
+                if (str->builder == NULL) HashMapDelete(&vm.interned_strings, str);
+                str->~RCString();
+            }
+            else
+            {
+                FreeEntries(((HashMap*)obj)->entries, ((HashMap*)obj)->capacity);
+            }
+        }
+    }
+
+    for (HashMap *map : frameArena.rememberedMaps) map->rememberedByFrameArena = false;
+    frameArena.rememberedMaps.clear();
+    for (PipArray *array : frameArena.rememberedArrays) array->rememberedByFrameArena = false;
+    frameArena.rememberedArrays.clear();
+    frameArena.objects.clear();
+    frameArena.buffer.arenaOffset = 0;
+}
+
+#endif // PIPLANG_FRAME_ARENA
+
 RCString *CopyString(const char *buf, int length, bool isConstant)
 {
     u32 stringhash = HashString(buf, length);
@@ -195,8 +1034,13 @@ RCString *CopyString(const char *buf, int length, bool isConstant)
         return internedString;
     }
 
-    RCString *string = (RCString*)NewRCObject(RCObject::STRING);
-    string->text = std::string(buf, length);
+    // Note(Kevin): constant strings are held onto by C++ code (e.g. PipAPI keys) so never put them in
+    //              the frame arena. A constant copy of a string the current frame already made still
+    //              returns the arena one though.
+    RCString *string = AllocateString((u32)length, !isConstant);
+    memcpy(string->chars, buf, length);
+    string->chars[length] = 0;
+    string->length = (u32)length;
     string->hash = stringhash;
     string->isConstant = isConstant;
 
@@ -205,6 +1049,59 @@ RCString *CopyString(const char *buf, int length, bool isConstant)
     return string;
 }
 
+// Concatenation results up to this long are interned right away. Keys and short labels stay one object
+// per distinct string; longer text is mostly built up to be printed or drawn.
+#define CONCAT_INTERN_MAX_LENGTH 32
+
+RCString *ConcatenateStrings(RCString *l, RCString *r)
+{
+    u32 leftLength = l->length;
+    u32 rightLength = r->length;
+    u32 length = leftLength + rightLength;
+    if (length <= CONCAT_INTERN_MAX_LENGTH)
+    {
+        char buf[CONCAT_INTERN_MAX_LENGTH];
+        memcpy(buf, RCStringChars(l), leftLength);
+        memcpy(buf + leftLength, RCStringChars(r), rightLength);
+        return CopyString(buf, (int)length, false);
+    }
+
+    RCStringBuilder *builder = l->builder;
+    if (builder && l->length == builder->chars.size())
+    {
+        // l ends where the buffer does so nothing else has appended to it yet, append in place. Strings
+        // sharing the buffer only look at their own prefix of it.
+        if (r->builder == builder)
+        {
+            std::string copy(RCStringChars(r), rightLength); // appending may reallocate what r points at
+            builder->chars.append(copy);
+        }
+        else
+        {
+            builder->chars.append(RCStringChars(r), rightLength);
+        }
+    }
+    else
+    {
+        builder = new RCStringBuilder();
+        builder->chars.reserve(length * 2);
+        builder->chars.append(RCStringChars(l), leftLength);
+        builder->chars.append(RCStringChars(r), rightLength);
+    }
+
+    RCString *string = (RCString*)NewRCObject(RCObject::STRING);
+    string->builder = builder;
+    string->length = length;
+    ++builder->users;
+    return string;
+}
+
+RCString *InternString(RCString *str)
+{
+    if (str->builder == NULL) return str;
+    return CopyString(RCStringChars(str), (int)str->length, false);
+}
+
 #include <vector>
 std::vector<PipFunction*> trackFunctions;
 
@@ -2,36 +2,86 @@
 
 #include "PipLangCommon.h"
 #include "Chunk.h"
+#include "../MemoryAllocator.h"
 
 struct RCObject
 {
-    enum OType
+    enum OType : u8
     {
         MAP,
-        //ARRAY,
-        STRING
+        ARRAY,
+        STRING,
+        BUFFER
+    };
+
+    // Cycle collector state. See CollectCycles.
+    enum GCColor : u8
+    {
+        BLACK,      // in use or free
+        GRAY,       // possible member of a cycle
+        WHITE,      // member of a garbage cycle
+        PURPLE,     // possible root of a cycle
+        RELEASED    // refcount hit 0 while buffered, contents freed, header freed by the collector
     };
 
     OType type;
+    GCColor gcColor = BLACK;
+    bool gcBuffered = false; // in the cycle collector's candidate roots
+    bool inZeroCountTable = false;
     i32 refCount = 0;
 };
 
+// Character buffer shared by the strings a chain of concatenations made. Each of them is a prefix of it.
+struct RCStringBuilder
+{
+    std::string chars;
+    int users = 0;
+};
+
 struct RCString
 {
     RCObject base;
 
-    std::string text;
     u32 hash;
+    u32 length;
     bool isConstant;
 
+    // Long concatenation results don't get their own characters and aren't interned. They are the first
+    // length chars of builder->chars instead, so s = s + "x" appends in place. See ConcatenateStrings.
+    RCStringBuilder *builder;
+
+    // Allocated with room for length chars and a terminating 0 (left empty in builder strings)
+    char chars[1];
+
     RCString()
     {
         base.type = RCObject::STRING;
         hash = 0;
+        length = 0;
         isConstant = false;
+        builder = NULL;
+        chars[0] = 0;
+    }
+
+    ~RCString()
+    {
+        if (builder && --builder->users == 0) delete builder;
     }
 };
 
+static inline const char *RCStringChars(const RCString *str)
+{
+    return str->builder ? str->builder->chars.data() : str->chars;
+}
+
+// Interned strings are equal only if they're the same object, builder strings have to be compared
+static inline bool RCStringEquals(const RCString *a, const RCString *b)
+{
+    if (a == b) return true;
+    if (a->builder == NULL && b->builder == NULL) return false;
+    return a->length == b->length && memcmp(RCStringChars(a), RCStringChars(b), a->length) == 0;
+}
+
 struct HashMapEntry
 {
     RCString* key = NULL;
@@ -45,6 +95,7 @@ struct HashMap
     int count;
     int capacity;
     HashMapEntry *entries;
+    bool rememberedByFrameArena; // in frameArena.rememberedMaps
 
     HashMap()
     {
@@ -52,13 +103,84 @@ struct HashMap
         count = 0;
         capacity = 0;
         entries = NULL;
+        rememberedByFrameArena = false;
     }
 };
 
+// Dynamic array of TValues stored back to back. Holds a reference to each RCObject in it like a map entry.
+struct PipArray
+{
+    RCObject base;
+
+    int count;
+    int capacity;
+    TValue *values;
+    bool rememberedByFrameArena; // in frameArena.rememberedArrays
+
+    PipArray()
+    {
+        base.type = RCObject::ARRAY;
+        count = 0;
+        capacity = 0;
+        values = NULL;
+        rememberedByFrameArena = false;
+    }
+};
+
+// Fixed size run of packed f32, i32 or u8 numbers for bulk game data (particle positions, velocities...).
+// Holds no references so the cycle collector never looks inside one. Natives can read data directly.
+struct PipBuffer
+{
+    enum ElementType : u8
+    {
+        F32,
+        I32,
+        U8
+    };
+
+    RCObject base;
+
+    ElementType elementType;
+    int count;
+    void *data; // calloc'd, count elements back to back
+
+    PipBuffer()
+    {
+        base.type = RCObject::BUFFER;
+        elementType = F32;
+        count = 0;
+        data = NULL;
+    }
+};
+
+static inline double BufferGet(const PipBuffer *buffer, int index)
+{
+    switch (buffer->elementType)
+    {
+        case PipBuffer::F32: return ((const float*)buffer->data)[index];
+        case PipBuffer::I32: return ((const i32*)buffer->data)[index];
+        case PipBuffer::U8:  return ((const u8*)buffer->data)[index];
+    }
+    return 0.0;
+}
+
+// Stores value converted to the element type: f32 rounds, i32 truncates and u8 clamps to [0, 255] first
+void BufferSet(PipBuffer *buffer, int index, double value);
+
+void ArrayAppend(PipArray *array, TValue value);
+TValue ArrayRemoveAt(PipArray *array, int index); // returns the removed value, caller releases it
+void FreeArray(PipArray *array);
+
+PipBuffer *NewBuffer(PipBuffer::ElementType elementType, int count);
+void BufferFill(PipBuffer *buffer, double value);
+void BufferAddScaled(PipBuffer *dst, const PipBuffer *src, double scale); // dst[i] += src[i] * scale, same count
+void BufferClamp(PipBuffer *buffer, double lo, double hi);
+
 void AllocateHashMap(HashMap *map);
 void FreeHashMap(HashMap *map);
 bool HashMapSet(HashMap *map, RCString *key, TValue value, TValue *replaced);
 bool HashMapGet(HashMap *map, RCString *key, TValue *value);
+HashMapEntry *HashMapGetEntry(HashMap *map, RCString *key); // NULL if key isn't in map
 bool HashMapDelete(HashMap *map, RCString *key);
 
 static inline bool IsRCObjType(TValue value, RCObject::OType type)
@@ -71,6 +193,10 @@ static inline bool IsRCObjType(TValue value, RCObject::OType type)
 #define RCOBJ_AS_STRING(value) ((RCString*)AS_RCOBJ(value))
 #define RCOBJ_IS_MAP(value)    IsRCObjType(value, RCObject::MAP)
 #define RCOBJ_AS_MAP(value)    ((HashMap*)AS_RCOBJ(value))
+#define RCOBJ_IS_ARRAY(value)  IsRCObjType(value, RCObject::ARRAY)
+#define RCOBJ_AS_ARRAY(value)  ((PipArray*)AS_RCOBJ(value))
+#define RCOBJ_IS_BUFFER(value) IsRCObjType(value, RCObject::BUFFER)
+#define RCOBJ_AS_BUFFER(value) ((PipBuffer*)AS_RCOBJ(value))
 
 RCObject *NewRCObject(RCObject::OType type);
 
@@ -78,6 +204,131 @@ void FreeRCObject(RCObject *obj);
 
 RCString *CopyString(const char *buf, int length, bool isConstant);
 
+// l + r. Short results are interned like any other string, long ones are builder strings.
+RCString *ConcatenateStrings(RCString *l, RCString *r);
+
+// The interned string with str's characters (str itself unless it's a builder string). Map keys must be
+// interned since maps compare keys by pointer.
+RCString *InternString(RCString *str);
+
+// Counts from the RCString / HashMap / PipArray / PipBuffer / HashMapEntry array pools
+struct PipObjectPoolStats
+{
+    size_t liveStrings = 0;
+    size_t peakStrings = 0;
+    size_t liveMaps = 0;
+    size_t peakMaps = 0;
+    size_t liveArrays = 0;
+    size_t peakArrays = 0;
+    size_t liveBuffers = 0;
+    size_t peakBuffers = 0;
+    size_t liveEntryArrays = 0; // pooled arrays only, maps over 256 entries are calloc'd
+    size_t peakEntryArrays = 0; // sum of each size class' peak
+    size_t slabBytes = 0;
+
+    size_t frameArenaPeakBytes = 0;
+    size_t lastFrameArenaObjects = 0;   // allocated from the frame arena during the last game function
+    size_t lastFramePromotedObjects = 0; // of those, copied to the heap because they outlived the frame
+};
+
+PipObjectPoolStats GetPipObjectPoolStats();
+
+/* Cycle collection: synchronous trial deletion (Bacon & Rajan 2001, "Concurrent Cycle Collection in
+   Reference Counted Systems"). A map or array whose refcount is decremented but stays above 0 might be what
+   keeps a garbage cycle alive so it is buffered as a candidate root. CollectCycles subtracts the references
+   that come from inside the subgraph reachable from the candidates; whatever ends up at 0 is only referenced
+   by garbage and gets freed. Strings and buffers can't reference anything so they are never traversed. */
+void BufferPossibleCycleRoot(RCObject *obj);
+
+static inline void PossibleCycleRoot(RCObject *obj)
+{
+    if ((obj->type == RCObject::MAP || obj->type == RCObject::ARRAY) && obj->gcColor != RCObject::PURPLE)
+    {
+        BufferPossibleCycleRoot(obj);
+    }
+}
+
+// Runs trial deletion over up to maxRoots of the buffered candidates. Returns how many are still buffered.
+size_t CollectCycles(size_t maxRoots);
+
+struct PipCycleCollectorStats
+{
+    size_t bufferedRoots = 0;
+    size_t lastScanned = 0;  // maps and arrays visited by the last CollectCycles
+    size_t lastFreed = 0;    // maps and arrays freed by the last CollectCycles
+    size_t totalScanned = 0;
+    size_t totalFreed = 0;
+    size_t collections = 0;
+};
+
+PipCycleCollectorStats GetPipCycleCollectorStats();
+
+#ifdef PIPLANG_DEFERRED_RC
+
+/* Zero count table for deferred reference counting (Deutsch & Bobrow 1976). A count of 0 only means no
+   heap references; the object may still be held by the VM stack. The VM reconciles the table against the
+   stack at safe points and frees whatever isn't on it. Constant strings are never freed so never added. */
+extern std::vector<RCObject*> zeroCountTable;
+
+static inline void AddToZeroCountTable(RCObject *obj)
+{
+    if (obj->inZeroCountTable) return;
+    if (obj->type == RCObject::STRING && ((RCString*)obj)->isConstant) return;
+    obj->inZeroCountTable = true;
+    zeroCountTable.push_back(obj);
+}
+
+#endif // PIPLANG_DEFERRED_RC
+
+#ifdef PIPLANG_FRAME_ARENA
+
+/* Escape tracking for the frame arena: nothing on the heap may point into the arena once it resets, so
+   every heap map or array that gets an arena key or value stored into it is remembered. At the end of the
+   frame the remembered maps and arrays and the VM stack are the roots; arena objects reachable from them are
+   copied to the heap and the references patched. Everything else in the arena is dead or leaked and is
+   dropped with it. Arrays and buffers themselves are never allocated from the arena. */
+struct PipFrameArena
+{
+    MemoryLinearBuffer buffer;
+    bool active = false;
+    std::vector<RCObject*> objects;
+    std::vector<HashMap*> rememberedMaps;
+    std::vector<PipArray*> rememberedArrays;
+};
+
+extern PipFrameArena frameArena;
+
+static inline bool IsInFrameArena(const void *ptr)
+{
+    return (const u8*)ptr >= frameArena.buffer.buffer && (const u8*)ptr < frameArena.buffer.buffer + frameArena.buffer.bufferSize;
+}
+
+void FrameArenaRememberMap(HashMap *map);
+
+// Call before storing key/value into map. Cheap when the arena isn't active.
+static inline void FrameArenaNoteStore(HashMap *map, RCString *key, TValue value)
+{
+    if (!frameArena.active || map->rememberedByFrameArena || IsInFrameArena(map)) return;
+    if (IsInFrameArena(key) || (IS_RCOBJ(value) && IsInFrameArena(AS_RCOBJ(value))))
+    {
+        FrameArenaRememberMap(map);
+    }
+}
+
+void FrameArenaRememberArray(PipArray *array);
+
+// Call before storing value into array
+static inline void FrameArenaNoteStore(PipArray *array, TValue value)
+{
+    if (!frameArena.active || array->rememberedByFrameArena) return;
+    if (IS_RCOBJ(value) && IsInFrameArena(AS_RCOBJ(value))) FrameArenaRememberArray(array);
+}
+
+void BeginFrameArena();
+void EndFrameArena(TValue *stackBegin, TValue *stackEnd);
+
+#endif // PIPLANG_FRAME_ARENA
+
 
 struct PipFunction
 {
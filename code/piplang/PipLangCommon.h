@@ -2,17 +2,53 @@
 
 #include "../MesaCommon.h"
 
+#include <cstring>
+
 
 //#define DEBUG_PRINT_CODE
 //#define DEBUG_TRACE_EXECUTION
 
+// Threaded dispatch in the VM's Run() loop. Needs the labels-as-values extension so GCC/Clang only;
+// everything else (MSVC) falls back to the switch. Define PIPLANG_NO_COMPUTED_GOTO to force the switch.
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(PIPLANG_NO_COMPUTED_GOTO)
+#define PIPLANG_COMPUTED_GOTO
+#endif
+
+// Compile arithmetic and comparisons to three-address REG_* instructions that read locals (slots in the
+// CallFrame's bp window) and constants directly instead of pushing them first. Off = the plain stack code.
+//#define PIPLANG_REGISTER_BACKEND
+
+// Maps and strings created while PipLangVM_RunGameFunction runs come out of a bump arena that is reset
+// wholesale when it returns. The ones that were stored somewhere that outlives the frame get copied to the
+// heap first. Define PIPLANG_NO_FRAME_ARENA to always allocate from the object pools.
+#if !defined(PIPLANG_NO_FRAME_ARENA)
+#define PIPLANG_FRAME_ARENA
+#endif
+
+// Deferred reference counting. Only references from the heap (map entries, globals) are counted; locals,
+// arguments and temporaries on the VM stack are not. Objects whose count drops to 0 go into a zero count
+// table which is checked against the stack at safe points (returns, loop back-edges, end of a script or
+// game function). Define PIPLANG_NO_DEFERRED_RC to count stack slots eagerly.
+#if !defined(PIPLANG_NO_DEFERRED_RC)
+#define PIPLANG_DEFERRED_RC
+#endif
+
+// SSE2 and AVX2 kernels for the bulk buf.* math (BufferMath.cpp), picked at runtime from what the CPU
+// supports. x86 only, everything else gets the scalar loops. Define PIPLANG_NO_SIMD to always use those.
+#if (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)) && !defined(PIPLANG_NO_SIMD)
+#define PIPLANG_SIMD
+#endif
+
 struct RCObject;
 struct PipFunction;
 
+// Ops that take a constant table index come in three consecutive forms, X with a one byte index, X_WIDE
+// with two and X_LONG with three (big endian). See WriteIndexedOp.
 enum class OpCode : u8
 {
     RETURN,
     CONSTANT,
+    CONSTANT_WIDE,
     CONSTANT_LONG,
     NEGATE,
     ADD,
@@ -28,8 +64,14 @@ enum class OpCode : u8
     POP,
     POP_LOCAL,
     DEFINE_GLOBAL,
-    GET_GLOBAL,
+    DEFINE_GLOBAL_WIDE,
+    DEFINE_GLOBAL_LONG,
+    GET_GLOBAL,         // constant index of the name then a 2-byte slot hint, like GET_FIELD
+    GET_GLOBAL_WIDE,
+    GET_GLOBAL_LONG,
     SET_GLOBAL,
+    SET_GLOBAL_WIDE,
+    SET_GLOBAL_LONG,
     GET_LOCAL,
     SET_LOCAL,
     JUMP,
@@ -41,9 +83,170 @@ enum class OpCode : u8
     SET_MAP_ENTRY,
     GET_MAP_ENTRY,
     DEL_MAP_ENTRY,
-    INCREMENT_REF_IF_RCOBJ
+    NEW_ARRAY,
+    ARRAY_APPEND,
+    GET_INDEX,
+    SET_INDEX,
+    INCREMENT_REF_IF_RCOBJ,
+
+    // Register backend. Encoding: op, mode, lhs, rhs, dst. See RegOperand for the mode byte.
+    REG_ADD,
+    REG_SUBTRACT,
+    REG_MULTIPLY,
+    REG_DIVIDE,
+    REG_EQUAL,
+    REG_GREATER,
+    REG_LESSER,
+
+    // Superinstructions produced by PeepholeOptimizeChunk
+    ADD_LOCAL_CONST,    // src local, constant, dst local
+    INDEX_LOCAL_CONST,  // array local, constant index: pushes array[index]
+    INDEX_LOCAL_LOCAL,  // array local, index local: pushes array[index]
+    NOT_EQUAL,
+    GREATER_EQUAL,      // !(l < r)
+    LESSER_EQUAL,       // !(l > r)
+    JUMP_IF_FALSE_POP,
+
+    // m.field with an inline cache. Encoding: op, constant index of the field name, 2-byte slot hint
+    GET_FIELD,
+    GET_FIELD_WIDE,
+    GET_FIELD_LONG,
+    SET_FIELD,
+    SET_FIELD_WIDE,
+    SET_FIELD_LONG
+};
+
+// Where a REG_* instruction operand lives. Mode byte = lhs | (rhs << 2) | (dst << 4).
+// STACK operands are popped (rhs first), a STACK dst is pushed. dst can't be CONST.
+enum RegOperand : u8
+{
+    REG_STACK = 0,
+    REG_LOCAL = 1, // index is offset from CallFrame bp
+    REG_CONST = 2  // index into chunk constants
+};
+
+// Store TValue as an 8-byte NaN-boxed u64 instead of the 16-byte tagged union. Halves the size of
+// the VM stack, HashMapEntry and chunk constants. Assumes 64-bit pointers that fit in 48 bits.
+//#define PIPLANG_NAN_BOXING
+
+#ifdef PIPLANG_NAN_BOXING
+
+// Note(Kevin): Anything that isn't a quiet NaN with bits 50 and 51 set is a double. Otherwise the
+//              sign bit and bits 48-49 are the tag and the low 48 bits are the payload:
+//                  0 01 -> bool (payload 0 or 1)
+//                  0 10 -> PipFunction *
+//                  0 11 -> NativeFn
+//                  1 00 -> RCObject *
+//              Zeroed memory (e.g. calloc'd HashMap entries) reads as the number 0 which is not TRUE
+//              so AS_BOOL on an empty entry is still false like the tagged union.
+#define PIPLANG_NANBOX_SIGN    ((u64)0x8000000000000000)
+#define PIPLANG_NANBOX_QNAN    ((u64)0x7ffc000000000000)
+#define PIPLANG_NANBOX_TAGMASK (PIPLANG_NANBOX_SIGN | PIPLANG_NANBOX_QNAN | ((u64)3 << 48))
+#define PIPLANG_NANBOX_PAYLOAD ((u64)0x0000ffffffffffff)
+#define PIPLANG_NANBOX_BOOL    (PIPLANG_NANBOX_QNAN | ((u64)1 << 48))
+#define PIPLANG_NANBOX_FUNC    (PIPLANG_NANBOX_QNAN | ((u64)2 << 48))
+#define PIPLANG_NANBOX_NATIVE  (PIPLANG_NANBOX_QNAN | ((u64)3 << 48))
+#define PIPLANG_NANBOX_RCOBJ   (PIPLANG_NANBOX_SIGN | PIPLANG_NANBOX_QNAN)
+#define PIPLANG_NANBOX_FALSE   (PIPLANG_NANBOX_BOOL | 0)
+#define PIPLANG_NANBOX_TRUE    (PIPLANG_NANBOX_BOOL | 1)
+
+static_assert(sizeof(void*) == 8, "PIPLANG_NAN_BOXING requires 64-bit pointers");
+
+struct TValue
+{
+    enum VType
+    {
+        BOOLEAN,
+        REAL,
+        FUNC,
+        NATIVEFN,
+        RCOBJ
+    };
+
+    u64 bits = PIPLANG_NANBOX_FALSE;
+
+    VType Type() const
+    {
+        if ((bits & PIPLANG_NANBOX_QNAN) != PIPLANG_NANBOX_QNAN) return REAL;
+        switch (bits & PIPLANG_NANBOX_TAGMASK)
+        {
+            case PIPLANG_NANBOX_BOOL:   return BOOLEAN;
+            case PIPLANG_NANBOX_FUNC:   return FUNC;
+            case PIPLANG_NANBOX_NATIVE: return NATIVEFN;
+            case PIPLANG_NANBOX_RCOBJ:  return RCOBJ;
+        }
+        return REAL; // a NaN produced by arithmetic
+    }
+
+    double AsNumber() const
+    {
+        double v;
+        memcpy(&v, &bits, sizeof(double));
+        return v;
+    }
+
+    static TValue Boolean(bool v)
+    {
+        TValue tv;
+        tv.bits = v ? PIPLANG_NANBOX_TRUE : PIPLANG_NANBOX_FALSE;
+        return tv;
+    }
+
+    static TValue Number(double v)
+    {
+        TValue tv;
+        memcpy(&tv.bits, &v, sizeof(double));
+        return tv;
+    }
+
+    static TValue Function(PipFunction *pipfn)
+    {
+        TValue tv;
+        tv.bits = PIPLANG_NANBOX_FUNC | ((u64)(uintptr_t)pipfn & PIPLANG_NANBOX_PAYLOAD);
+        return tv;
+    }
+
+    static TValue NativeFunction(void *nativefn)
+    {
+        TValue tv;
+        tv.bits = PIPLANG_NANBOX_NATIVE | ((u64)(uintptr_t)nativefn & PIPLANG_NANBOX_PAYLOAD);
+        return tv;
+    }
+
+    static TValue RCObject(RCObject *ptr)
+    {
+        TValue tv;
+        tv.bits = PIPLANG_NANBOX_RCOBJ | ((u64)(uintptr_t)ptr & PIPLANG_NANBOX_PAYLOAD);
+        return tv;
+    }
 };
 
+static_assert(sizeof(TValue) == 8, "NaN-boxed TValue should be 8 bytes");
+
+typedef TValue (*NativeFn)(int argc, TValue *argv);
+
+#define BOOL_VAL(boolean)      (TValue::Boolean(boolean))
+#define NUMBER_VAL(real)       (TValue::Number(real))
+#define FUNCTION_VAL(pipfn)    (TValue::Function(pipfn))
+#define NATIVEFN_VAL(nativefn) (TValue::NativeFunction(nativefn))
+#define RCOBJ_VAL(rcobj)       (TValue::RCObject(rcobj))
+
+#define AS_BOOL(value)         ((value).bits == PIPLANG_NANBOX_TRUE)
+#define AS_NUMBER(value)       ((value).AsNumber())
+#define AS_FUNCTION(value)     ((PipFunction*)(uintptr_t)((value).bits & PIPLANG_NANBOX_PAYLOAD))
+#define AS_NATIVEFN(value)     ((NativeFn)(uintptr_t)((value).bits & PIPLANG_NANBOX_PAYLOAD))
+#define AS_RCOBJ(value)        ((RCObject*)(uintptr_t)((value).bits & PIPLANG_NANBOX_PAYLOAD))
+
+#define IS_BOOL(value)         (((value).bits | 1) == PIPLANG_NANBOX_TRUE)
+#define IS_NUMBER(value)       (((value).bits & PIPLANG_NANBOX_QNAN) != PIPLANG_NANBOX_QNAN)
+#define IS_FUNCTION(value)     (((value).bits & PIPLANG_NANBOX_TAGMASK) == PIPLANG_NANBOX_FUNC)
+#define IS_NATIVEFN(value)     (((value).bits & PIPLANG_NANBOX_TAGMASK) == PIPLANG_NANBOX_NATIVE)
+#define IS_RCOBJ(value)        (((value).bits & PIPLANG_NANBOX_TAGMASK) == PIPLANG_NANBOX_RCOBJ)
+
+#define TVALUE_TYPE(value)     ((value).Type())
+
+#else // PIPLANG_NAN_BOXING
+
 struct TValue
 {
     enum VType
@@ -127,6 +330,10 @@ typedef TValue (*NativeFn)(int argc, TValue *argv);
 #define IS_NATIVEFN(value)     ((value).type == TValue::NATIVEFN)
 #define IS_RCOBJ(value)        ((value).type == TValue::RCOBJ)
 
+#define TVALUE_TYPE(value)     ((value).type)
+
+#endif // PIPLANG_NAN_BOXING
+
 
 #if (defined _MSC_VER)
 #define PipLangAssert(predicate) if(!(predicate)) { __debugbreak(); }
@@ -52,7 +52,7 @@ struct Token
     const char *start;
     TokenType type;
     u16 length;
-    u16 line;
+    int line; // not u16, scripts can run past 65535 lines
 
     const char *errormsg;
     u16 errormsglen;
@@ -8,6 +8,7 @@
 #include "Scanner.h"
 #include "Compiler.h"
 #include "Object.h"
+#include "BufferMath.h"
 
 /// VM
 
@@ -31,23 +32,32 @@ static TValue Stack_Pop()
     return *vm.sp;
 }
 
-static TValue Stack_Peek(int distance)
-{
-    return vm.sp[-1 - distance];
-}
-
 #pragma region RuntimeErrors
 
 static bool pipunitTestEnvironmentEnabled = false;
 static int pipUnitTestsRan = 0;
 static int pipunitTestsPassed = 0;
 static int pipunitTestsFailed = 0;
+static int pipunitTicksToRun = 0;
 static bool nativeRuntimeErrorFiredFlag = false;
 static char lastRuntimeErrorMessage[256];
 
+// Note(Kevin): under pipunit a runtime error only returns from the frame it happened in, so an error
+// that no checkerror asks about just skips the rest of its test. Count it as a failed test instead.
+static void PipUnit_FailUncheckedRuntimeError()
+{
+    if (!pipunitTestEnvironmentEnabled || lastRuntimeErrorMessage[0] == '\0') return;
+
+    ++pipUnitTestsRan;
+    ++pipunitTestsFailed;
+    printf("RUNTIME ERROR FAIL: '%s' was not expected by a checkerror.\n", lastRuntimeErrorMessage);
+    memset(lastRuntimeErrorMessage, 0, ARRAY_COUNT(lastRuntimeErrorMessage));
+}
+
 void PipLangVM_NativeRuntimeError(const char *format, ...)
 {
     nativeRuntimeErrorFiredFlag = true;
+    PipUnit_FailUncheckedRuntimeError();
 
     va_list args;
     va_start(args, format);
@@ -55,8 +65,8 @@ void PipLangVM_NativeRuntimeError(const char *format, ...)
     va_end(args);
 
     CallFrame *frame = &vm.frames[vm.frameCount - 1];
-    size_t instruction = frame->ip - frame->fn->chunk.bytecode->data() - 1;
-    int line = frame->fn->chunk.linenumbers->at(instruction);
+    size_t instruction = frame->ip - frame->fn->chunk.code - 1;
+    int line = GetLine(&frame->fn->chunk, (int)instruction);
     fprintf(stderr, "[line %d] Runtime error: %s", line, lastRuntimeErrorMessage);
     fputs("\n", stderr);
 
@@ -70,14 +80,16 @@ void PipLangVM_NativeRuntimeError(const char *format, ...)
 
 static void RuntimeError(const char *format, ...)
 {
+    PipUnit_FailUncheckedRuntimeError();
+
     va_list args;
     va_start(args, format);
     vsprintf(lastRuntimeErrorMessage, format, args);
     va_end(args);
 
     CallFrame *frame = &vm.frames[vm.frameCount - 1];
-    size_t instruction = frame->ip - frame->fn->chunk.bytecode->data() - 1;
-    int line = frame->fn->chunk.linenumbers->at(instruction);
+    size_t instruction = frame->ip - frame->fn->chunk.code - 1;
+    int line = GetLine(&frame->fn->chunk, (int)instruction);
     fprintf(stderr, "[line %d] Runtime error: %s", line, lastRuntimeErrorMessage);
     fputs("\n", stderr);
 
@@ -92,15 +104,15 @@ static void RuntimeError(const char *format, ...)
     {
         frame = &vm.frames[i];
         PipFunction *fn = frame->fn;
-        instruction = frame->ip - fn->chunk.bytecode->data() - 1;
-        fprintf(stderr, "[line %d] in ", fn->chunk.linenumbers->at(instruction));
+        instruction = frame->ip - fn->chunk.code - 1;
+        fprintf(stderr, "[line %d] in ", GetLine(&fn->chunk, (int)instruction));
         if (fn->name == NULL)
         {
             fprintf(stderr, "top-level script\n");
         }
         else
         {
-            fprintf(stderr, "%s()\n", fn->name->text.c_str());
+            fprintf(stderr, "%s()\n", fn->name->chars);
         }
     }
 
@@ -114,27 +126,21 @@ static bool IsFalsey(TValue v)
     return !AS_BOOL(v);
 }
 
-static void ConcatenateStrings()
-{
-    RCString *r = RCOBJ_AS_STRING(Stack_Pop());
-    RCString *l = RCOBJ_AS_STRING(Stack_Pop());
-    std::string temp = (l->text + r->text);
-    Stack_Push(RCOBJ_VAL((RCObject*)CopyString(temp.c_str(), (int)temp.size(), false)));
-}
-
 static bool IsEqual(TValue l, TValue r)
 {
-    if (l.type != r.type) 
+    TValue::VType type = TVALUE_TYPE(l);
+    if (type != TVALUE_TYPE(r)) 
         return false;
 
-    switch (l.type) 
+    switch (type) 
     {
         case TValue::BOOLEAN: return AS_BOOL(l) == AS_BOOL(r);
         case TValue::REAL:    return AS_NUMBER(l) == AS_NUMBER(r);
         case TValue::FUNC:    return AS_FUNCTION(l) == AS_FUNCTION(r);
         case TValue::RCOBJ:
         {
-            return AS_RCOBJ(l) == AS_RCOBJ(r);
+            if (AS_RCOBJ(l) == AS_RCOBJ(r)) return true;
+            return RCOBJ_IS_STRING(l) && RCOBJ_IS_STRING(r) && RCStringEquals(RCOBJ_AS_STRING(l), RCOBJ_AS_STRING(r));
         }
         default: return false;
     }
@@ -155,14 +161,18 @@ static bool PushCallFrame(PipFunction *fn, u8 argc)
 
     CallFrame *frame = &vm.frames[vm.frameCount++];
     frame->fn = fn;
-    frame->ip = fn->chunk.bytecode->data();
+    frame->ip = fn->chunk.code;
     frame->bp = vm.sp - argc - 1;
+    frame->kp = fn->chunk.constantTable;
     return true;
 }
 
 static i32 DecrementRefButDontDestroy(TValue v);
 static void CheckRefCountAndDestroy(TValue v);
 static i32 DecrementRef(TValue v);
+#ifdef PIPLANG_DEFERRED_RC
+static void ReleaseStackRef(TValue v);
+#endif
 static bool CallValue(TValue callee, u8 argc)
 {
     if (IS_FUNCTION(callee))
@@ -173,24 +183,34 @@ static bool CallValue(TValue callee, u8 argc)
     {
         NativeFn native = AS_NATIVEFN(callee);
         // Note(Kevin): Native functions should not retain or release any references to RCOBJs!!!
+#ifndef PIPLANG_DEFERRED_RC
         for (TValue *arg = vm.sp - argc; arg < vm.sp; ++arg)
         {
             // Note(Kevin): RCOBJ passed as arg will increment 1 ref count from being a fn arg so decrement 1
             if (IS_RCOBJ(*arg))
                 DecrementRefButDontDestroy(*arg);
         }
+#endif
         TValue result = native(argc, vm.sp - argc);
+#ifndef PIPLANG_DEFERRED_RC
         for (TValue *arg = vm.sp - argc; arg < vm.sp; ++arg)
         {
             // Note(Kevin): Make sure transient RCOBJs passed as arg are destroyed
             if (IS_RCOBJ(*arg))
                 CheckRefCountAndDestroy(*arg);
         }
+#endif
         if (nativeRuntimeErrorFiredFlag)
         {
             nativeRuntimeErrorFiredFlag = false;
+#ifndef PIPLANG_DEFERRED_RC
+            vm.sp -= argc + 1; // the args were released above, don't let unwinding release them again
+#endif
             return false;
         }
+#ifdef PIPLANG_DEFERRED_RC
+        for (TValue *arg = vm.sp - argc; arg < vm.sp; ++arg) ReleaseStackRef(*arg);
+#endif
         vm.sp -= argc + 1;
         Stack_Push(result);
         return true;
@@ -231,6 +251,14 @@ static void CheckRefCountAndDestroy(TValue v)
                 }
             }
         }
+        else if (RCOBJ_IS_ARRAY(v))
+        {
+            PipArray *array = RCOBJ_AS_ARRAY(v);
+            for (int i = 0; i < array->count; ++i)
+            {
+                if (IS_RCOBJ(array->values[i])) DecrementRef(array->values[i]);
+            }
+        }
         FreeRCObject(obj);
     }
 }
@@ -238,336 +266,1024 @@ static void CheckRefCountAndDestroy(TValue v)
 static i32 DecrementRef(TValue v)
 {
     i32 ref = DecrementRefButDontDestroy(v);
-    CheckRefCountAndDestroy(v);
+    if (ref > 0) PossibleCycleRoot(AS_RCOBJ(v));
+#ifdef PIPLANG_DEFERRED_RC
+    else AddToZeroCountTable(AS_RCOBJ(v)); // the stack might still hold it
+#else
+    else CheckRefCountAndDestroy(v);
+#endif
     return ref;
 }
 
+#ifdef PIPLANG_DEFERRED_RC
+
+// A stack slot (local, argument or temporary) let go of v. The slot was never counted so there is nothing
+// to decrement, but the object might have been waiting on it.
+static void ReleaseStackRef(TValue v)
+{
+    if (!IS_RCOBJ(v)) return;
+    RCObject *obj = AS_RCOBJ(v);
+    if (obj->refCount > 0) PossibleCycleRoot(obj);
+    else AddToZeroCountTable(obj);
+}
+
+// Reconcile once the table has grown by this many entries since the last time
+#define ZERO_COUNT_TABLE_SLACK 256
+
+static size_t zeroCountTableLimit = ZERO_COUNT_TABLE_SLACK;
+static size_t zeroCountReconciles = 0;
+static size_t zeroCountFreed = 0;
+
+// Count the stack's references for the duration of a reconcile or cycle collection
+static void PinStackRefs(TValue *stackTop)
+{
+    for (TValue *v = vm.stack; v < stackTop; ++v)
+    {
+        if (IS_RCOBJ(*v)) IncrementRef(*v);
+    }
+}
+
+static void UnpinStackRefs(TValue *stackTop)
+{
+    for (TValue *v = vm.stack; v < stackTop; ++v)
+    {
+        if (IS_RCOBJ(*v) && DecrementRefButDontDestroy(*v) <= 0) AddToZeroCountTable(AS_RCOBJ(*v));
+    }
+}
+
+// Frees every object in the zero count table that the stack doesn't hold. Destroying a map decrements its
+// entries which can add more to the table; those are handled in the same pass. Whatever only the stack
+// holds goes back into the table.
+static void ReconcileZeroCountTable(TValue *stackTop)
+{
+    ++zeroCountReconciles;
+    PinStackRefs(stackTop);
+    while (!zeroCountTable.empty())
+    {
+        RCObject *obj = zeroCountTable.back();
+        zeroCountTable.pop_back();
+        obj->inZeroCountTable = false;
+        if (obj->refCount <= 0)
+        {
+            ++zeroCountFreed;
+            CheckRefCountAndDestroy(RCOBJ_VAL(obj));
+        }
+    }
+    UnpinStackRefs(stackTop);
+    zeroCountTableLimit = zeroCountTable.size() + ZERO_COUNT_TABLE_SLACK;
+}
+
+#endif // PIPLANG_DEFERRED_RC
+
+// Overwrite a local slot
+static inline void StoreLocal(TValue *slot, TValue value)
+{
+    TValue replaced = *slot;
+    *slot = value;
+#ifdef PIPLANG_DEFERRED_RC
+    ReleaseStackRef(replaced);
+#else
+    if (IS_RCOBJ(value)) IncrementRef(value);
+    if (IS_RCOBJ(replaced)) DecrementRef(replaced);
+#endif
+}
+
+// A temporary popped off the stack for good
+static inline void PopTemporary(TValue v)
+{
+#ifdef PIPLANG_DEFERRED_RC
+    ReleaseStackRef(v);
+#else
+    if (IS_RCOBJ(v)) CheckRefCountAndDestroy(v);
+#endif
+}
+
+// A local or parameter going out of scope
+static inline void PopLocal(TValue v)
+{
+#ifdef PIPLANG_DEFERRED_RC
+    ReleaseStackRef(v);
+#else
+    if (IS_RCOBJ(v)) DecrementRef(v);
+#endif
+}
+
+// Index into an array of count elements, -1 if i isn't a whole number in [0, count)
+static inline int ArrayIndex(TValue i, int count)
+{
+    if (!IS_NUMBER(i)) return -1;
+    double d = AS_NUMBER(i);
+    if (!(d >= 0.0 && d < (double)count)) return -1;
+    int index = (int)d;
+    return (double)index == d ? index : -1;
+}
+
+static const char *notIndexableError = "Only arrays and buffers can be indexed with [].";
+static const char *indexOutOfRangeError = "Array index out of range or not a whole number.";
+
+// a[i] for an array or buffer. False if a isn't either or i is out of range.
+static inline bool IndexArrayOrBuffer(TValue a, TValue i, TValue *out)
+{
+    if (RCOBJ_IS_ARRAY(a))
+    {
+        PipArray *array = RCOBJ_AS_ARRAY(a);
+        int index = ArrayIndex(i, array->count);
+        if (index < 0) return false;
+        *out = array->values[index];
+        return true;
+    }
+    if (RCOBJ_IS_BUFFER(a))
+    {
+        PipBuffer *buffer = RCOBJ_AS_BUFFER(a);
+        int index = ArrayIndex(i, buffer->count);
+        if (index < 0) return false;
+        *out = NUMBER_VAL(BufferGet(buffer, index));
+        return true;
+    }
+    return false;
+}
+
+static HashMapEntry *LookupEntryAndFillCache(HashMap *map, RCString *key, u8 *slotHint)
+{
+    HashMapEntry *entry = HashMapGetEntry(map, key);
+    if (entry == NULL) return NULL;
+
+    ptrdiff_t slot = entry - map->entries;
+    if (slot <= UINT16_MAX)
+    {
+        slotHint[0] = (u8)(slot >> 8);
+        slotHint[1] = (u8)slot;
+    }
+    return entry;
+}
+
+// Inline cache for GET_GLOBAL/SET_GLOBAL and GET_FIELD/SET_FIELD. The two bytes after the constant index
+// are a hint for which slot of the map holds the key. The hint is only trusted if that slot's key is still
+// the key (keys are interned and appear at most once in a map), so a rehash, redefinition or delete can't
+// make it stale. It just misses and gets refilled.
+// Note(Kevin): Maps that got the same keys inserted in the same order have the same capacity and the
+//              same slot for every key, so one hint serves every "same shaped" map that reaches a site.
+static inline HashMapEntry *GetMapEntryCached(HashMap *map, RCString *key, u8 *slotHint)
+{
+    u32 slot = (u32)((slotHint[0] << 8) | slotHint[1]);
+    if (slot < (u32)map->capacity && map->entries[slot].key == key)
+        return &map->entries[slot];
+    return LookupEntryAndFillCache(map, key, slotHint);
+}
+
 static InterpretResult Run()
 {
+    // Note(Kevin): ip, bp, and sp are kept in locals so the compiler can hold them in registers. They are
+    // only written back to the CallFrame / vm when something outside Run needs them: calls, returns, and
+    // runtime errors (which read frame->ip to report the line number).
     CallFrame *frame = &vm.frames[vm.frameCount - 1];
-
-#define VM_READ_BYTE() (*frame->ip++) // read byte and move pointer along
-#define VM_READ_WORD() (frame->ip += 2, (u16)((frame->ip[-2] << 8) | frame->ip[-1]))
-#define VM_READ_THREE_BYTES() (frame->ip += 3, (u32)((frame->ip[-3] << 8) | (frame->ip[-2] << 8) | frame->ip[-1]))
-#define VM_READ_CONSTANT() (frame->fn->chunk.constants->at(VM_READ_BYTE()))
-#define VM_READ_CONSTANT_LONG() (frame->fn->chunk.constants->at(VM_READ_THREE_BYTES()))
-#define VM_BINARY_OP(resultValueConstructor, op) \
+    u8 *ip = frame->ip;
+    TValue *bp = frame->bp;
+    TValue *sp = vm.sp;
+    TValue *kp = frame->kp; // constants, also what REG_CONST operands index
+    u32 operand; // constant index of an op with _WIDE and _LONG forms, read before jumping to the shared body
+
+#define VM_READ_BYTE() (*ip++) // read byte and move pointer along
+#define VM_READ_WORD() (ip += 2, (u16)((ip[-2] << 8) | ip[-1]))
+#define VM_READ_THREE_BYTES() (ip += 3, (u32)((ip[-3] << 16) | (ip[-2] << 8) | ip[-1]))
+#define VM_READ_CONSTANT() (kp[VM_READ_BYTE()])
+#define VM_READ_CONSTANT_WIDE() (kp[VM_READ_WORD()])
+#define VM_READ_CONSTANT_LONG() (kp[VM_READ_THREE_BYTES()])
+#define VM_PUSH(value) (*sp++ = (value))
+#define VM_POP() (*--sp)
+#define VM_PEEK(distance) (sp[-1 - (distance)])
+#define VM_STORE_FRAME() \
     do { \
-        if (!IS_NUMBER(Stack_Peek(0)) || !IS_NUMBER(Stack_Peek(1))) \
-        { \
-            RuntimeError("Operands to BINOP must be number values."); \
-            return InterpretResult::RUNTIME_ERROR; \
-        } \
-        double r = Stack_Pop().real; \
-        double l = Stack_Pop().real; \
-        Stack_Push(resultValueConstructor(l op r)); \
+        frame->ip = ip; \
+        vm.sp = sp; \
+    } while (false)
+#define VM_LOAD_FRAME() \
+    do { \
+        frame = &vm.frames[vm.frameCount - 1]; \
+        ip = frame->ip; \
+        bp = frame->bp; \
+        kp = frame->kp; \
+        sp = vm.sp; \
+    } while (false)
+#define VM_RUNTIME_ERROR(...) \
+    do { \
+        VM_STORE_FRAME(); \
+        RuntimeError(__VA_ARGS__); \
     } while (false)
 #define VM_RETURN_RUNTIME_ERROR() \
-    do {                          \
+    do { \
         if (pipunitTestEnvironmentEnabled) \
         { \
-            Stack_Push({}); \
-            op = OpCode::RETURN; \
-            goto START_OF_OP_SWITCH; \
+            VM_PUSH(TValue()); \
+            goto RETURN_FROM_CURRENT_FRAME; \
         } \
         else \
         { \
             return InterpretResult::RUNTIME_ERROR; \
         } \
     } while (false)
+#define VM_BINARY_OP(resultValueConstructor, op) \
+    do { \
+        if (!IS_NUMBER(VM_PEEK(0)) || !IS_NUMBER(VM_PEEK(1))) \
+        { \
+            VM_RUNTIME_ERROR("Operands to BINOP must be number values."); \
+            VM_RETURN_RUNTIME_ERROR(); \
+        } \
+        double r = AS_NUMBER(VM_POP()); \
+        double l = AS_NUMBER(VM_POP()); \
+        VM_PUSH(resultValueConstructor(l op r)); \
+    } while (false)
+
+// Register backend operands. rhs is read before lhs so that when both are REG_STACK the top of the
+// stack is popped as rhs.
+#define VM_REG_OPERAND(kind, index) \
+    ((kind) == REG_LOCAL ? bp[(index)] \
+                         : (kind) == REG_CONST ? kp[(index)] : VM_POP())
+#define VM_REG_DECODE() \
+    u8 mode = VM_READ_BYTE(); \
+    u8 lhsIndex = VM_READ_BYTE(); \
+    u8 rhsIndex = VM_READ_BYTE(); \
+    u8 dstIndex = VM_READ_BYTE(); \
+    TValue r = VM_REG_OPERAND((mode >> 2) & 3, rhsIndex); \
+    TValue l = VM_REG_OPERAND(mode & 3, lhsIndex)
+#define VM_REG_STORE(value) \
+    do { \
+        if ((mode >> 4) == REG_LOCAL) \
+        { \
+            StoreLocal(&bp[dstIndex], (value)); \
+        } \
+        else \
+        { \
+            VM_PUSH(value); \
+        } \
+    } while (false)
+// REG_STACK operands were popped for good, so they are let go of like the operands of ADD
+#define VM_REG_POP_TEMPORARIES() \
+    do { \
+        if ((mode & 3) == REG_STACK) PopTemporary(l); \
+        if (((mode >> 2) & 3) == REG_STACK) PopTemporary(r); \
+    } while (false)
+#define VM_REG_BINARY_OP(resultValueConstructor, op) \
+    do { \
+        VM_REG_DECODE(); \
+        if (!IS_NUMBER(l) || !IS_NUMBER(r)) \
+        { \
+            VM_RUNTIME_ERROR("Operands to BINOP must be number values."); \
+            VM_RETURN_RUNTIME_ERROR(); \
+        } \
+        TValue result = resultValueConstructor(AS_NUMBER(l) op AS_NUMBER(r)); \
+        VM_REG_STORE(result); \
+        VM_REG_POP_TEMPORARIES(); \
+    } while (false)
 
+#ifdef DEBUG_TRACE_EXECUTION
+#define VM_TRACE_INSTRUCTION() \
+    do { \
+        printf("          "); \
+        for (TValue *slot = vm.stack; slot < sp; ++slot) \
+        { \
+            printf("[ "); \
+            PrintTValue(*slot); \
+            printf(" ]"); \
+        } \
+        printf("\n"); \
+        DisassembleInstruction(&frame->fn->chunk, (int)(ip - frame->fn->chunk.code)); \
+    } while (false)
+#else
+#define VM_TRACE_INSTRUCTION() do {} while (false)
+#endif
 
+#ifdef PIPLANG_COMPUTED_GOTO
+    // Threaded dispatch: every handler jumps straight to the handler of the next opcode instead of going
+    // back through a single switch. Table is filled by opcode value so it doesn't depend on enum ordering.
+    static void *dispatchTable[256];
+    static bool dispatchTableFilled = false;
+    if (!dispatchTableFilled)
+    {
+        for (int i = 0; i < 256; ++i) dispatchTable[i] = &&OP_UNKNOWN;
+#define VM_DISPATCH_ENTRY(name) dispatchTable[(u8)OpCode::name] = &&OP_##name
+        VM_DISPATCH_ENTRY(RETURN);
+        VM_DISPATCH_ENTRY(CONSTANT);
+        VM_DISPATCH_ENTRY(CONSTANT_WIDE);
+        VM_DISPATCH_ENTRY(CONSTANT_LONG);
+        VM_DISPATCH_ENTRY(NEGATE);
+        VM_DISPATCH_ENTRY(ADD);
+        VM_DISPATCH_ENTRY(SUBTRACT);
+        VM_DISPATCH_ENTRY(MULTIPLY);
+        VM_DISPATCH_ENTRY(DIVIDE);
+        VM_DISPATCH_ENTRY(OP_TRUE);
+        VM_DISPATCH_ENTRY(OP_FALSE);
+        VM_DISPATCH_ENTRY(LOGICAL_NOT);
+        VM_DISPATCH_ENTRY(RELOP_EQUAL);
+        VM_DISPATCH_ENTRY(RELOP_GREATER);
+        VM_DISPATCH_ENTRY(RELOP_LESSER);
+        VM_DISPATCH_ENTRY(POP);
+        VM_DISPATCH_ENTRY(POP_LOCAL);
+        VM_DISPATCH_ENTRY(DEFINE_GLOBAL);
+        VM_DISPATCH_ENTRY(DEFINE_GLOBAL_WIDE);
+        VM_DISPATCH_ENTRY(DEFINE_GLOBAL_LONG);
+        VM_DISPATCH_ENTRY(GET_GLOBAL);
+        VM_DISPATCH_ENTRY(GET_GLOBAL_WIDE);
+        VM_DISPATCH_ENTRY(GET_GLOBAL_LONG);
+        VM_DISPATCH_ENTRY(SET_GLOBAL);
+        VM_DISPATCH_ENTRY(SET_GLOBAL_WIDE);
+        VM_DISPATCH_ENTRY(SET_GLOBAL_LONG);
+        VM_DISPATCH_ENTRY(GET_LOCAL);
+        VM_DISPATCH_ENTRY(SET_LOCAL);
+        VM_DISPATCH_ENTRY(JUMP);
+        VM_DISPATCH_ENTRY(JUMP_BACK);
+        VM_DISPATCH_ENTRY(JUMP_IF_FALSE);
+        VM_DISPATCH_ENTRY(CALL);
+        VM_DISPATCH_ENTRY(PRINT);
+        VM_DISPATCH_ENTRY(NEW_HASHMAP);
+        VM_DISPATCH_ENTRY(SET_MAP_ENTRY);
+        VM_DISPATCH_ENTRY(GET_MAP_ENTRY);
+        VM_DISPATCH_ENTRY(DEL_MAP_ENTRY);
+        VM_DISPATCH_ENTRY(NEW_ARRAY);
+        VM_DISPATCH_ENTRY(ARRAY_APPEND);
+        VM_DISPATCH_ENTRY(GET_INDEX);
+        VM_DISPATCH_ENTRY(SET_INDEX);
+        VM_DISPATCH_ENTRY(INCREMENT_REF_IF_RCOBJ);
+        VM_DISPATCH_ENTRY(REG_ADD);
+        VM_DISPATCH_ENTRY(REG_SUBTRACT);
+        VM_DISPATCH_ENTRY(REG_MULTIPLY);
+        VM_DISPATCH_ENTRY(REG_DIVIDE);
+        VM_DISPATCH_ENTRY(REG_EQUAL);
+        VM_DISPATCH_ENTRY(REG_GREATER);
+        VM_DISPATCH_ENTRY(REG_LESSER);
+        VM_DISPATCH_ENTRY(ADD_LOCAL_CONST);
+        VM_DISPATCH_ENTRY(INDEX_LOCAL_CONST);
+        VM_DISPATCH_ENTRY(INDEX_LOCAL_LOCAL);
+        VM_DISPATCH_ENTRY(NOT_EQUAL);
+        VM_DISPATCH_ENTRY(GREATER_EQUAL);
+        VM_DISPATCH_ENTRY(LESSER_EQUAL);
+        VM_DISPATCH_ENTRY(JUMP_IF_FALSE_POP);
+        VM_DISPATCH_ENTRY(GET_FIELD);
+        VM_DISPATCH_ENTRY(GET_FIELD_WIDE);
+        VM_DISPATCH_ENTRY(GET_FIELD_LONG);
+        VM_DISPATCH_ENTRY(SET_FIELD);
+        VM_DISPATCH_ENTRY(SET_FIELD_WIDE);
+        VM_DISPATCH_ENTRY(SET_FIELD_LONG);
+#undef VM_DISPATCH_ENTRY
+        dispatchTableFilled = true;
+    }
+#define VM_CASE(name) OP_##name
+#define VM_NEXT() \
+    do { \
+        VM_TRACE_INSTRUCTION(); \
+        goto *dispatchTable[VM_READ_BYTE()]; \
+    } while (false)
+
+    VM_NEXT();
+#else
+#define VM_CASE(name) case OpCode::name
+#define VM_NEXT() continue
+#endif
 
     for (;;)
     {
-#ifdef DEBUG_TRACE_EXECUTION
-        printf("          ");
-        for (TValue *slot = vm.stack; slot < vm.sp; ++slot)
+        VM_TRACE_INSTRUCTION();
+        switch ((OpCode)VM_READ_BYTE())
         {
-            printf("[ ");
-            PrintTValue(*slot);
-            printf(" ]");
-        }
-        printf("\n");
-        DisassembleInstruction(&frame->fn->chunk, (int)(frame->ip - frame->fn->chunk.bytecode->data()));
-#endif
-        OpCode op = (OpCode)VM_READ_BYTE();
-START_OF_OP_SWITCH:
-        switch (op)
-        {
-            case OpCode::NEW_HASHMAP:
+            VM_CASE(NEW_HASHMAP):
             {
                 RCObject* map = NewRCObject(RCObject::MAP);
-                Stack_Push(RCOBJ_VAL(map));
-                break;
+                VM_PUSH(RCOBJ_VAL(map));
+                VM_NEXT();
             }
 
-            case OpCode::PRINT:
-                PrintTValue(Stack_Pop());
+            VM_CASE(NEW_ARRAY):
+            {
+                RCObject* array = NewRCObject(RCObject::ARRAY);
+                VM_PUSH(RCOBJ_VAL(array));
+                VM_NEXT();
+            }
+
+            VM_CASE(PRINT):
+            {
+                PrintTValue(VM_POP());
                 printf("\n");
-                break;
+                VM_NEXT();
+            }
 
-            case OpCode::RETURN:
+            VM_CASE(RETURN):
+            RETURN_FROM_CURRENT_FRAME:
             {
-                TValue result = Stack_Pop();
+                TValue result = VM_POP();
                 --vm.frameCount;
                 if (vm.frameCount == 0)
                 {
-                    Stack_Pop();
+#ifdef PIPLANG_DEFERRED_RC
+                    // Nothing of the outermost frame outlives it, the caller of Run reconciles right after
+                    ReleaseStackRef(result);
+                    while (sp > bp) ReleaseStackRef(VM_POP());
+#else
+                    --sp;
+#endif
+                    vm.sp = sp;
                     return InterpretResult::OK;
                 }
 
+#ifdef PIPLANG_DEFERRED_RC
+                while (sp > bp + 1) ReleaseStackRef(VM_POP());
+                --sp;
+#else
                 bool isResultRefCounted = IS_RCOBJ(result);
 
                 // Need to sweep all locals to decrement ref
                 // This sweeps from sp to bp so works even for returns mid lexical-scope (i.e. mid for-loop)
                 {
-                    while (vm.sp > frame->bp + 1) // Note(Kevin): +1 is because first local is reserved for fn itself
+                    while (sp > bp + 1) // Note(Kevin): +1 is because first local is reserved for fn itself
                     {
-                        TValue localOrParam = Stack_Pop();
+                        TValue localOrParam = VM_POP();
                         if (IS_RCOBJ(localOrParam))
                         {
-                            if (isResultRefCounted && localOrParam.rcobj == result.rcobj)
+                            if (isResultRefCounted && AS_RCOBJ(localOrParam) == AS_RCOBJ(result))
                                 DecrementRefButDontDestroy(
                                         localOrParam); // return value is transient until captured or OpCode::POP
                             else
                                 DecrementRef(localOrParam);
                         }
                     }
-                    --vm.sp;
+                    --sp;
                 }
+#endif
 
-                Stack_Push(result);
-                frame = &vm.frames[vm.frameCount - 1];
-                break;
+                VM_PUSH(result);
+                vm.sp = sp;
+#ifdef PIPLANG_DEFERRED_RC
+                if (zeroCountTable.size() >= zeroCountTableLimit) ReconcileZeroCountTable(sp);
+#endif
+                VM_LOAD_FRAME();
+                VM_NEXT();
             }
 
-            case OpCode::CALL:
+            VM_CASE(CALL):
             {
                 u8 argc = VM_READ_BYTE();
-                if (!CallValue(Stack_Peek(argc), argc))
+                TValue callee = VM_PEEK(argc);
+                if (IS_FUNCTION(callee) && AS_FUNCTION(callee)->arity == argc && vm.frameCount < FRAMES_MAX)
                 {
+                    // Fast path for script functions; same as PushCallFrame without the round trip through vm.sp
+                    frame->ip = ip;
+                    frame = &vm.frames[vm.frameCount++];
+                    frame->fn = AS_FUNCTION(callee);
+                    frame->bp = bp = sp - argc - 1;
+                    ip = frame->fn->chunk.code;
+                    kp = frame->kp = frame->fn->chunk.constantTable;
+                    VM_NEXT();
+                }
+                VM_STORE_FRAME();
+                if (!CallValue(callee, argc))
+                {
+                    sp = vm.sp;
                     VM_RETURN_RUNTIME_ERROR();
                 }
-                frame = &vm.frames[vm.frameCount - 1]; // Move to callee frame
-                break;
+                VM_LOAD_FRAME(); // Move to callee frame
+                VM_NEXT();
+            }
+
+            VM_CASE(CONSTANT):
+            {
+                VM_PUSH(VM_READ_CONSTANT());
+                VM_NEXT();
             }
 
-            case OpCode::CONSTANT:
-                Stack_Push(VM_READ_CONSTANT());
-                break;
+            VM_CASE(CONSTANT_WIDE):
+            {
+                VM_PUSH(VM_READ_CONSTANT_WIDE());
+                VM_NEXT();
+            }
 
-            case OpCode::CONSTANT_LONG:
-                Stack_Push(VM_READ_CONSTANT_LONG());
-                break;
+            VM_CASE(CONSTANT_LONG):
+            {
+                VM_PUSH(VM_READ_CONSTANT_LONG());
+                VM_NEXT();
+            }
 
-            case OpCode::POP:
+            VM_CASE(POP):
             {
-                TValue v = Stack_Pop();
-                if (IS_RCOBJ(v)) CheckRefCountAndDestroy(v);
-                break;
+                PopTemporary(VM_POP());
+                VM_NEXT();
             }
 
-            case OpCode::POP_LOCAL:
+            VM_CASE(POP_LOCAL):
             {
-                TValue v = Stack_Pop();
-                if (IS_RCOBJ(v)) DecrementRef(v);
-                break;
+                PopLocal(VM_POP());
+                VM_NEXT();
             }
 
-            case OpCode::INCREMENT_REF_IF_RCOBJ:
+            VM_CASE(INCREMENT_REF_IF_RCOBJ):
             {
-                TValue v = Stack_Peek(0);
+                TValue v = VM_PEEK(0);
                 if (IS_RCOBJ(v)) IncrementRef(v);
-                break;
+                VM_NEXT();
             }
 
-            case OpCode::DEFINE_GLOBAL:
+            VM_CASE(DEFINE_GLOBAL): operand = VM_READ_BYTE(); goto DEFINE_GLOBAL_BODY;
+            VM_CASE(DEFINE_GLOBAL_WIDE): operand = VM_READ_WORD(); goto DEFINE_GLOBAL_BODY;
+            VM_CASE(DEFINE_GLOBAL_LONG): operand = VM_READ_THREE_BYTES();
+            DEFINE_GLOBAL_BODY:
             {
-                RCString *name = RCOBJ_AS_STRING(VM_READ_CONSTANT_LONG());
-                TValue value = Stack_Peek(0);
+                RCString *name = RCOBJ_AS_STRING(kp[operand]);
+                TValue value = VM_PEEK(0);
                 HashMapSet(&vm.globals, name, value, NULL);
                 IncrementRef(RCOBJ_VAL((RCObject*)name));
                 if (IS_RCOBJ(value)) IncrementRef(value);
-                Stack_Pop();
-                break;
+                --sp;
+                VM_NEXT();
             }
 
-            case OpCode::GET_GLOBAL:
+            VM_CASE(GET_GLOBAL): operand = VM_READ_BYTE(); goto GET_GLOBAL_BODY;
+            VM_CASE(GET_GLOBAL_WIDE): operand = VM_READ_WORD(); goto GET_GLOBAL_BODY;
+            VM_CASE(GET_GLOBAL_LONG): operand = VM_READ_THREE_BYTES();
+            GET_GLOBAL_BODY:
             {
-                RCString *name = RCOBJ_AS_STRING(VM_READ_CONSTANT_LONG());
-                TValue value;
-                if (!HashMapGet(&vm.globals, name, &value))
+                RCString *name = RCOBJ_AS_STRING(kp[operand]);
+                HashMapEntry *entry = GetMapEntryCached(&vm.globals, name, ip);
+                ip += 2;
+                if (entry == NULL)
                 {
-                    RuntimeError("Undefined variable '%s'.", name->text.c_str());
+                    VM_RUNTIME_ERROR("Undefined variable '%s'.", name->chars);
                     VM_RETURN_RUNTIME_ERROR();
                 }
-                Stack_Push(value);
-                break;
+                VM_PUSH(entry->value);
+                VM_NEXT();
             }
 
-            case OpCode::SET_GLOBAL:
+            VM_CASE(SET_GLOBAL): operand = VM_READ_BYTE(); goto SET_GLOBAL_BODY;
+            VM_CASE(SET_GLOBAL_WIDE): operand = VM_READ_WORD(); goto SET_GLOBAL_BODY;
+            VM_CASE(SET_GLOBAL_LONG): operand = VM_READ_THREE_BYTES();
+            SET_GLOBAL_BODY:
             {
-                RCString *name = RCOBJ_AS_STRING(VM_READ_CONSTANT_LONG());
-                TValue replaced;
-                TValue value = Stack_Peek(0);
-                bool isNewKey = HashMapSet(&vm.globals, name, value, &replaced);
-                if (isNewKey)
+                RCString *name = RCOBJ_AS_STRING(kp[operand]);
+                HashMapEntry *entry = GetMapEntryCached(&vm.globals, name, ip);
+                ip += 2;
+                if (entry == NULL)
                 {
-                    HashMapDelete(&vm.globals, name);
-                    RuntimeError("Undefined variable '%s'.", name->text.c_str());
+                    VM_RUNTIME_ERROR("Undefined variable '%s'.", name->chars);
                     VM_RETURN_RUNTIME_ERROR();
                 }
+                TValue value = VM_POP();
+#ifdef PIPLANG_FRAME_ARENA
+                FrameArenaNoteStore(&vm.globals, name, value);
+#endif
+                TValue replaced = entry->value;
+                entry->value = value;
                 if (IS_RCOBJ(value)) IncrementRef(value);
                 if (IS_RCOBJ(replaced)) DecrementRef(replaced);
-                Stack_Pop();
-                break;
+                VM_NEXT();
             }
 
-            case OpCode::GET_LOCAL:
+            VM_CASE(GET_LOCAL):
             {
                 u8 bpOffset = VM_READ_BYTE();
-                Stack_Push(frame->bp[bpOffset]);
-                break;
+                VM_PUSH(bp[bpOffset]);
+                VM_NEXT();
             }
 
-            case OpCode::SET_LOCAL:
+            VM_CASE(SET_LOCAL):
             {
                 u8 bpOffset = VM_READ_BYTE();
-                TValue value = Stack_Pop();
-                TValue replaced = frame->bp[bpOffset];
-                frame->bp[bpOffset] = value;
-                if (IS_RCOBJ(value)) IncrementRef(value);
-                if (IS_RCOBJ(replaced)) DecrementRef(replaced);
-                break;
+                StoreLocal(&bp[bpOffset], VM_POP());
+                VM_NEXT();
             }
 
-            case OpCode::SET_MAP_ENTRY:
+            VM_CASE(SET_MAP_ENTRY):
             {
-                TValue v = Stack_Pop();
-                TValue k = Stack_Pop();
-                TValue m = Stack_Peek(0);
+                TValue v = VM_POP();
+                TValue k = VM_POP();
+                TValue m = VM_PEEK(0);
                 if (!RCOBJ_IS_MAP(m) || !RCOBJ_IS_STRING(k))
                 {
-                    RuntimeError("Provided invalid map or key when setting map entry.");
+                    VM_RUNTIME_ERROR("Provided invalid map or key when setting map entry.");
                     VM_RETURN_RUNTIME_ERROR();
                 }
+                RCString *key = InternString(RCOBJ_AS_STRING(k));
                 TValue replaced;
-                bool isNewKey = HashMapSet(RCOBJ_AS_MAP(m), RCOBJ_AS_STRING(k), v, &replaced);
-                if (isNewKey) IncrementRef(k);
+                bool isNewKey = HashMapSet(RCOBJ_AS_MAP(m), key, v, &replaced);
+                if (isNewKey) IncrementRef(RCOBJ_VAL((RCObject*)key));
                 if (IS_RCOBJ(v)) IncrementRef(v);
                 if (!isNewKey && IS_RCOBJ(replaced)) DecrementRef(replaced);
-                break;
+                if (key != RCOBJ_AS_STRING(k)) PopTemporary(k);
+                VM_NEXT();
             }
 
-            case OpCode::GET_MAP_ENTRY:
+            VM_CASE(GET_MAP_ENTRY):
             {
-                TValue k = Stack_Pop();
-                TValue m = Stack_Pop();
+                TValue k = VM_POP();
+                TValue m = VM_POP();
                 if (!RCOBJ_IS_MAP(m) || !RCOBJ_IS_STRING(k))
                 {
-                    RuntimeError("Provided invalid map or key when getting map entry.");
+                    VM_RUNTIME_ERROR("Provided invalid map or key when getting map entry.");
                     VM_RETURN_RUNTIME_ERROR();
                 }
+                RCString *key = InternString(RCOBJ_AS_STRING(k));
                 TValue v;
-                if (!HashMapGet(RCOBJ_AS_MAP(m), RCOBJ_AS_STRING(k), &v))
+                bool found = HashMapGet(RCOBJ_AS_MAP(m), key, &v);
+#ifdef PIPLANG_DEFERRED_RC
+                if (key != RCOBJ_AS_STRING(k)) ReleaseStackRef(RCOBJ_VAL((RCObject*)key)); // freshly interned
+#endif
+                if (!found)
                 {
-                    RuntimeError("Provided key does not exist in map.");
+                    VM_RUNTIME_ERROR("Provided key does not exist in map.");
                     VM_RETURN_RUNTIME_ERROR();
                 }
-                Stack_Push(v);
-                break;
+                VM_PUSH(v);
+#ifdef PIPLANG_DEFERRED_RC
+                ReleaseStackRef(k);
+                ReleaseStackRef(m);
+#endif
+                VM_NEXT();
             }
 
-            case OpCode::DEL_MAP_ENTRY:
+            VM_CASE(GET_FIELD): operand = VM_READ_BYTE(); goto GET_FIELD_BODY;
+            VM_CASE(GET_FIELD_WIDE): operand = VM_READ_WORD(); goto GET_FIELD_BODY;
+            VM_CASE(GET_FIELD_LONG): operand = VM_READ_THREE_BYTES();
+            GET_FIELD_BODY:
             {
-                TValue k = Stack_Pop();
-                TValue m = Stack_Peek(0);
+                RCString *key = RCOBJ_AS_STRING(kp[operand]);
+                TValue m = VM_POP();
+                if (!RCOBJ_IS_MAP(m))
+                {
+                    ip += 2;
+                    VM_RUNTIME_ERROR("Provided invalid map or key when getting map entry.");
+                    VM_RETURN_RUNTIME_ERROR();
+                }
+                HashMapEntry *entry = GetMapEntryCached(RCOBJ_AS_MAP(m), key, ip);
+                ip += 2;
+                if (entry == NULL)
+                {
+                    VM_RUNTIME_ERROR("Provided key does not exist in map.");
+                    VM_RETURN_RUNTIME_ERROR();
+                }
+                VM_PUSH(entry->value);
+#ifdef PIPLANG_DEFERRED_RC
+                ReleaseStackRef(m); // e.g. MakeThing().field
+#endif
+                VM_NEXT();
+            }
+
+            VM_CASE(SET_FIELD): operand = VM_READ_BYTE(); goto SET_FIELD_BODY;
+            VM_CASE(SET_FIELD_WIDE): operand = VM_READ_WORD(); goto SET_FIELD_BODY;
+            VM_CASE(SET_FIELD_LONG): operand = VM_READ_THREE_BYTES();
+            SET_FIELD_BODY:
+            {
+                RCString *key = RCOBJ_AS_STRING(kp[operand]);
+                TValue v = VM_POP();
+                TValue m = VM_PEEK(0);
+                if (!RCOBJ_IS_MAP(m))
+                {
+                    ip += 2;
+                    VM_RUNTIME_ERROR("Provided invalid map or key when setting map entry.");
+                    VM_RETURN_RUNTIME_ERROR();
+                }
+                HashMap *map = RCOBJ_AS_MAP(m);
+                u32 slot = (u32)((ip[0] << 8) | ip[1]);
+                ip += 2;
+                if (slot < (u32)map->capacity && map->entries[slot].key == key)
+                {
+#ifdef PIPLANG_FRAME_ARENA
+                    FrameArenaNoteStore(map, key, v);
+#endif
+                    TValue replaced = map->entries[slot].value;
+                    map->entries[slot].value = v;
+                    if (IS_RCOBJ(v)) IncrementRef(v);
+                    if (IS_RCOBJ(replaced)) DecrementRef(replaced);
+                    VM_NEXT();
+                }
+                // Same as SET_MAP_ENTRY then refill the hint. Can't fill it before HashMapSet since a new key
+                // can grow the map.
+                TValue replaced;
+                bool isNewKey = HashMapSet(map, key, v, &replaced);
+                if (isNewKey) IncrementRef(RCOBJ_VAL((RCObject*)key));
+                if (IS_RCOBJ(v)) IncrementRef(v);
+                if (!isNewKey && IS_RCOBJ(replaced)) DecrementRef(replaced);
+                LookupEntryAndFillCache(map, key, ip - 2);
+                VM_NEXT();
+            }
+
+            VM_CASE(DEL_MAP_ENTRY):
+            {
+                TValue k = VM_POP();
+                TValue m = VM_PEEK(0);
+                if (RCOBJ_IS_ARRAY(m)) // a.remove(i) compiles to the same op
+                {
+                    PipArray *array = RCOBJ_AS_ARRAY(m);
+                    int index = ArrayIndex(k, array->count);
+                    if (index < 0)
+                    {
+                        VM_RUNTIME_ERROR("Array index out of range or not a whole number.");
+                        VM_RETURN_RUNTIME_ERROR();
+                    }
+                    TValue removed = ArrayRemoveAt(array, index);
+                    if (IS_RCOBJ(removed)) DecrementRef(removed);
+                    VM_NEXT();
+                }
                 if (!RCOBJ_IS_MAP(m) || !RCOBJ_IS_STRING(k))
                 {
-                    RuntimeError("Provided invalid map to 'insert' contextual keyword.");
+                    VM_RUNTIME_ERROR("Provided invalid map to 'insert' contextual keyword.");
                     VM_RETURN_RUNTIME_ERROR();
                 }
+                RCString *key = InternString(RCOBJ_AS_STRING(k));
                 TValue v;
-                if (!HashMapGet(RCOBJ_AS_MAP(m), RCOBJ_AS_STRING(k), &v))
+                if (!HashMapGet(RCOBJ_AS_MAP(m), key, &v))
                 {
-                    RuntimeError("Provided key does not exist in map"); // TODO probably just make this a warning
+#ifdef PIPLANG_DEFERRED_RC
+                    if (key != RCOBJ_AS_STRING(k)) ReleaseStackRef(RCOBJ_VAL((RCObject*)key)); // freshly interned
+#endif
+                    VM_RUNTIME_ERROR("Provided key does not exist in map"); // TODO probably just make this a warning
                     VM_RETURN_RUNTIME_ERROR();
                 }
-                HashMapDelete(RCOBJ_AS_MAP(m), RCOBJ_AS_STRING(k));
-                DecrementRef(k);
+                HashMapDelete(RCOBJ_AS_MAP(m), key);
+                DecrementRef(RCOBJ_VAL((RCObject*)key));
                 if (IS_RCOBJ(v)) DecrementRef(v);
-                break;
+                if (key != RCOBJ_AS_STRING(k)) PopTemporary(k);
+                VM_NEXT();
+            }
+
+            VM_CASE(ARRAY_APPEND):
+            {
+                TValue v = VM_POP();
+                TValue a = VM_PEEK(0);
+                if (!RCOBJ_IS_ARRAY(a))
+                {
+                    VM_RUNTIME_ERROR("Provided invalid array to 'append' contextual keyword.");
+                    VM_RETURN_RUNTIME_ERROR();
+                }
+                ArrayAppend(RCOBJ_AS_ARRAY(a), v);
+                if (IS_RCOBJ(v)) IncrementRef(v);
+                VM_NEXT();
+            }
+
+            VM_CASE(GET_INDEX):
+            {
+                TValue i = VM_POP();
+                TValue a = VM_POP();
+                TValue v;
+                if (!IndexArrayOrBuffer(a, i, &v))
+                {
+                    VM_RUNTIME_ERROR("%s", RCOBJ_IS_ARRAY(a) || RCOBJ_IS_BUFFER(a) ? indexOutOfRangeError : notIndexableError);
+                    VM_RETURN_RUNTIME_ERROR();
+                }
+                VM_PUSH(v);
+#ifdef PIPLANG_DEFERRED_RC
+                ReleaseStackRef(a); // e.g. MakeList()[0]
+#endif
+                VM_NEXT();
+            }
+
+            // GET_LOCAL, CONSTANT/GET_LOCAL, GET_INDEX. The array stays in its local so there's no stack ref
+            // to release.
+            VM_CASE(INDEX_LOCAL_CONST):
+            VM_CASE(INDEX_LOCAL_LOCAL):
+            {
+                OpCode op = (OpCode)ip[-1];
+                TValue a = bp[VM_READ_BYTE()];
+                u8 indexOperand = VM_READ_BYTE();
+                TValue i = op == OpCode::INDEX_LOCAL_CONST ? kp[indexOperand] : bp[indexOperand];
+                TValue v;
+                if (!IndexArrayOrBuffer(a, i, &v))
+                {
+                    VM_RUNTIME_ERROR("%s", RCOBJ_IS_ARRAY(a) || RCOBJ_IS_BUFFER(a) ? indexOutOfRangeError : notIndexableError);
+                    VM_RETURN_RUNTIME_ERROR();
+                }
+                VM_PUSH(v);
+                VM_NEXT();
             }
 
-            case OpCode::NEGATE:
+            VM_CASE(SET_INDEX):
             {
-                if (!IS_NUMBER(Stack_Peek(0)))
+                TValue v = VM_POP();
+                TValue i = VM_POP();
+                TValue a = VM_PEEK(0);
+                if (RCOBJ_IS_BUFFER(a))
+                {
+                    PipBuffer *buffer = RCOBJ_AS_BUFFER(a);
+                    int index = ArrayIndex(i, buffer->count);
+                    if (index < 0)
+                    {
+                        VM_RUNTIME_ERROR("%s", indexOutOfRangeError);
+                        VM_RETURN_RUNTIME_ERROR();
+                    }
+                    if (!IS_NUMBER(v))
+                    {
+                        VM_RUNTIME_ERROR("Buffers can only hold numbers.");
+                        VM_RETURN_RUNTIME_ERROR();
+                    }
+                    BufferSet(buffer, index, AS_NUMBER(v));
+                    VM_NEXT();
+                }
+                if (!RCOBJ_IS_ARRAY(a))
+                {
+                    VM_RUNTIME_ERROR("%s", notIndexableError);
+                    VM_RETURN_RUNTIME_ERROR();
+                }
+                PipArray *array = RCOBJ_AS_ARRAY(a);
+                int index = ArrayIndex(i, array->count);
+                if (index < 0)
                 {
-                    RuntimeError("Operand to NEGATE op must be a number value.");
+                    VM_RUNTIME_ERROR("%s", indexOutOfRangeError);
                     VM_RETURN_RUNTIME_ERROR();
                 }
-                Stack_Push(TValue::Number(-AS_NUMBER(Stack_Pop())));
-                break;
+#ifdef PIPLANG_FRAME_ARENA
+                FrameArenaNoteStore(array, v);
+#endif
+                TValue replaced = array->values[index];
+                array->values[index] = v;
+                if (IS_RCOBJ(v)) IncrementRef(v);
+                if (IS_RCOBJ(replaced)) DecrementRef(replaced);
+                VM_NEXT();
+            }
+
+            VM_CASE(NEGATE):
+            {
+                if (!IS_NUMBER(VM_PEEK(0)))
+                {
+                    VM_RUNTIME_ERROR("Operand to NEGATE op must be a number value.");
+                    VM_RETURN_RUNTIME_ERROR();
+                }
+                sp[-1] = NUMBER_VAL(-AS_NUMBER(sp[-1]));
+                VM_NEXT();
             }
-            case OpCode::ADD: 
+
+            VM_CASE(ADD):
             {
-                if (RCOBJ_IS_STRING(Stack_Peek(0)) && RCOBJ_IS_STRING(Stack_Peek(1)))
+                if (RCOBJ_IS_STRING(VM_PEEK(0)) && RCOBJ_IS_STRING(VM_PEEK(1)))
                 {
-                    ConcatenateStrings();
+                    RCString *r = RCOBJ_AS_STRING(VM_POP());
+                    RCString *l = RCOBJ_AS_STRING(VM_POP());
+                    VM_PUSH(RCOBJ_VAL((RCObject*)ConcatenateStrings(l, r)));
+                    // intermediate strings of a longer concatenation are garbage from here
+                    PopTemporary(RCOBJ_VAL((RCObject*)l));
+                    PopTemporary(RCOBJ_VAL((RCObject*)r));
                 }
-                else if (IS_NUMBER(Stack_Peek(0)) && IS_NUMBER(Stack_Peek(1)))
+                else if (IS_NUMBER(VM_PEEK(0)) && IS_NUMBER(VM_PEEK(1)))
                 {
-                    double r = Stack_Pop().real;
-                    double l = Stack_Pop().real;
-                    Stack_Push(NUMBER_VAL(l + r));
+                    double r = AS_NUMBER(VM_POP());
+                    double l = AS_NUMBER(VM_POP());
+                    VM_PUSH(NUMBER_VAL(l + r));
                 }
                 else
                 {
-                    RuntimeError("Operands to BINOP must be number values.");
+                    VM_RUNTIME_ERROR("Operands to BINOP must be number values.");
+                    VM_RETURN_RUNTIME_ERROR();
+                }
+                VM_NEXT();
+            }
+
+            VM_CASE(SUBTRACT): VM_BINARY_OP(NUMBER_VAL, -); VM_NEXT();
+            VM_CASE(MULTIPLY): VM_BINARY_OP(NUMBER_VAL, *); VM_NEXT();
+            VM_CASE(DIVIDE): VM_BINARY_OP(NUMBER_VAL, /); VM_NEXT();
+
+            VM_CASE(OP_TRUE): VM_PUSH(BOOL_VAL(true)); VM_NEXT();
+            VM_CASE(OP_FALSE): VM_PUSH(BOOL_VAL(false)); VM_NEXT();
+
+            VM_CASE(LOGICAL_NOT):
+            {
+                if (!IS_BOOL(VM_PEEK(0)))
+                {
+                    VM_RUNTIME_ERROR("Operand to LOGICAL NOT op must be a boolean value.");
                     VM_RETURN_RUNTIME_ERROR();
                 }
-                break;
+                sp[-1] = BOOL_VAL(IsFalsey(sp[-1]));
+                VM_NEXT();
+            }
+
+            VM_CASE(RELOP_EQUAL):
+            {
+                TValue r = VM_POP();
+                TValue l = VM_POP();
+                VM_PUSH(BOOL_VAL(IsEqual(l, r)));
+                PopTemporary(l);
+                PopTemporary(r);
+                VM_NEXT();
+            }
+
+            VM_CASE(RELOP_GREATER): VM_BINARY_OP(BOOL_VAL, >); VM_NEXT();
+            VM_CASE(RELOP_LESSER): VM_BINARY_OP(BOOL_VAL, <); VM_NEXT();
+
+            VM_CASE(NOT_EQUAL):
+            {
+                TValue r = VM_POP();
+                TValue l = VM_POP();
+                VM_PUSH(BOOL_VAL(!IsEqual(l, r)));
+                PopTemporary(l);
+                PopTemporary(r);
+                VM_NEXT();
             }
-            case OpCode::SUBTRACT: VM_BINARY_OP(NUMBER_VAL, -); break;
-            case OpCode::MULTIPLY: VM_BINARY_OP(NUMBER_VAL, *); break;
-            case OpCode::DIVIDE: VM_BINARY_OP(NUMBER_VAL, /); break;
 
-            case OpCode::OP_TRUE: Stack_Push(BOOL_VAL(true)); break;
-            case OpCode::OP_FALSE: Stack_Push(BOOL_VAL(false)); break;
-            case OpCode::LOGICAL_NOT:
-                if (!IS_BOOL(Stack_Peek(0)))
+            // Note(Kevin): written as !(l < r) and !(l > r) so NaN compares the same as the unfused
+            //              RELOP + LOGICAL_NOT sequence
+#define VM_NOT_BOOL_VAL(b) BOOL_VAL(!(b))
+            VM_CASE(GREATER_EQUAL): VM_BINARY_OP(VM_NOT_BOOL_VAL, <); VM_NEXT();
+            VM_CASE(LESSER_EQUAL): VM_BINARY_OP(VM_NOT_BOOL_VAL, >); VM_NEXT();
+#undef VM_NOT_BOOL_VAL
+
+            VM_CASE(ADD_LOCAL_CONST):
+            {
+                TValue l = bp[VM_READ_BYTE()];
+                TValue r = VM_READ_CONSTANT();
+                u8 dst = VM_READ_BYTE();
+                TValue result;
+                if (IS_NUMBER(l) && IS_NUMBER(r))
+                {
+                    result = NUMBER_VAL(AS_NUMBER(l) + AS_NUMBER(r));
+                }
+                else if (RCOBJ_IS_STRING(l) && RCOBJ_IS_STRING(r))
+                {
+                    result = RCOBJ_VAL((RCObject*)ConcatenateStrings(RCOBJ_AS_STRING(l), RCOBJ_AS_STRING(r)));
+                }
+                else
                 {
-                    RuntimeError("Operand to LOGICAL NOT op must be a boolean value.");
+                    VM_RUNTIME_ERROR("Operands to BINOP must be number values.");
                     VM_RETURN_RUNTIME_ERROR();
                 }
-                Stack_Push(BOOL_VAL(IsFalsey(Stack_Pop())));
-                break;
-            case OpCode::RELOP_EQUAL:
-                Stack_Push(BOOL_VAL(IsEqual(Stack_Pop(), Stack_Pop())));
-                break;
-            case OpCode::RELOP_GREATER: VM_BINARY_OP(BOOL_VAL, >); break;
-            case OpCode::RELOP_LESSER: VM_BINARY_OP(BOOL_VAL, <); break;
+                StoreLocal(&bp[dst], result);
+                VM_NEXT();
+            }
 
-            case OpCode::JUMP_IF_FALSE: 
+            VM_CASE(REG_ADD):
+            {
+                VM_REG_DECODE();
+                TValue result;
+                if (IS_NUMBER(l) && IS_NUMBER(r))
+                {
+                    result = NUMBER_VAL(AS_NUMBER(l) + AS_NUMBER(r));
+                }
+                else if (RCOBJ_IS_STRING(l) && RCOBJ_IS_STRING(r))
+                {
+                    result = RCOBJ_VAL((RCObject*)ConcatenateStrings(RCOBJ_AS_STRING(l), RCOBJ_AS_STRING(r)));
+                }
+                else
+                {
+                    VM_RUNTIME_ERROR("Operands to BINOP must be number values.");
+                    VM_RETURN_RUNTIME_ERROR();
+                }
+                VM_REG_STORE(result);
+                VM_REG_POP_TEMPORARIES();
+                VM_NEXT();
+            }
+
+            VM_CASE(REG_SUBTRACT): VM_REG_BINARY_OP(NUMBER_VAL, -); VM_NEXT();
+            VM_CASE(REG_MULTIPLY): VM_REG_BINARY_OP(NUMBER_VAL, *); VM_NEXT();
+            VM_CASE(REG_DIVIDE): VM_REG_BINARY_OP(NUMBER_VAL, /); VM_NEXT();
+            VM_CASE(REG_GREATER): VM_REG_BINARY_OP(BOOL_VAL, >); VM_NEXT();
+            VM_CASE(REG_LESSER): VM_REG_BINARY_OP(BOOL_VAL, <); VM_NEXT();
+
+            VM_CASE(REG_EQUAL):
+            {
+                VM_REG_DECODE();
+                TValue result = BOOL_VAL(IsEqual(l, r));
+                VM_REG_STORE(result);
+                VM_REG_POP_TEMPORARIES();
+                VM_NEXT();
+            }
+
+            VM_CASE(JUMP_IF_FALSE):
             {
                 u16 jumpOffset = VM_READ_WORD();
-                if (IsFalsey(Stack_Peek(0))) frame->ip += jumpOffset;
-                break;
+                if (IsFalsey(VM_PEEK(0))) ip += jumpOffset;
+                VM_NEXT();
             }
 
-            case OpCode::JUMP:
+            VM_CASE(JUMP_IF_FALSE_POP):
             {
                 u16 jumpOffset = VM_READ_WORD();
-                frame->ip += jumpOffset;
-                break;
+                TValue v = VM_POP();
+                if (IsFalsey(v)) ip += jumpOffset;
+                PopTemporary(v);
+                VM_NEXT();
             }
 
-            case OpCode::JUMP_BACK:
+            VM_CASE(JUMP):
             {
                 u16 jumpOffset = VM_READ_WORD();
-                frame->ip -= jumpOffset;
-                break;
+                ip += jumpOffset;
+                VM_NEXT();
+            }
+
+            VM_CASE(JUMP_BACK):
+            {
+                u16 jumpOffset = VM_READ_WORD();
+                ip -= jumpOffset;
+#ifdef PIPLANG_DEFERRED_RC
+                if (zeroCountTable.size() >= zeroCountTableLimit)
+                {
+                    vm.sp = sp;
+                    ReconcileZeroCountTable(sp);
+                }
+#endif
+                VM_NEXT();
+            }
+
+#ifdef PIPLANG_COMPUTED_GOTO
+            OP_UNKNOWN:
+#endif
+            default:
+            {
+                VM_RUNTIME_ERROR("Unknown opcode %d.", ip[-1]);
+                return InterpretResult::RUNTIME_ERROR;
             }
         }
     }
@@ -577,9 +1293,24 @@ START_OF_OP_SWITCH:
 #undef VM_READ_WORD
 #undef VM_READ_THREE_BYTES
 #undef VM_READ_CONSTANT
+#undef VM_READ_CONSTANT_WIDE
 #undef VM_READ_CONSTANT_LONG
-#undef VM_BINARY_OP
+#undef VM_PUSH
+#undef VM_POP
+#undef VM_PEEK
+#undef VM_STORE_FRAME
+#undef VM_LOAD_FRAME
+#undef VM_RUNTIME_ERROR
 #undef VM_RETURN_RUNTIME_ERROR
+#undef VM_BINARY_OP
+#undef VM_REG_OPERAND
+#undef VM_REG_DECODE
+#undef VM_REG_STORE
+#undef VM_REG_POP_TEMPORARIES
+#undef VM_REG_BINARY_OP
+#undef VM_TRACE_INSTRUCTION
+#undef VM_CASE
+#undef VM_NEXT
 }
 
 #include "../UTILITY.H"
@@ -593,9 +1324,189 @@ static InterpretResult Interpret(const char *source)
     PushCallFrame(script, 0);
 
     InterpretResult result = Run();
+#ifdef PIPLANG_DEFERRED_RC
+    ReconcileZeroCountTable(vm.sp);
+#endif
     return result;
 }
 
+// len(x): elements in an array or buffer, entries in a map or chars in a string
+static TValue Builtin_len(int argc, TValue *argv)
+{
+    if (argc != 1 || !IS_RCOBJ(argv[0]))
+    {
+        PipLangVM_NativeRuntimeError("len expects an array, buffer, map or string as its argument.");
+        return NUMBER_VAL(-1);
+    }
+    switch (RCOBJ_TYPE(argv[0]))
+    {
+        case RCObject::ARRAY:  return NUMBER_VAL(RCOBJ_AS_ARRAY(argv[0])->count);
+        case RCObject::MAP:
+        {
+            // count includes tombstones
+            HashMap *map = RCOBJ_AS_MAP(argv[0]);
+            int entries = 0;
+            for (int i = 0; i < map->capacity; ++i)
+            {
+                if (map->entries[i].key) ++entries;
+            }
+            return NUMBER_VAL(entries);
+        }
+        case RCObject::STRING: return NUMBER_VAL(RCOBJ_AS_STRING(argv[0])->length);
+        case RCObject::BUFFER: return NUMBER_VAL(RCOBJ_AS_BUFFER(argv[0])->count);
+    }
+    return NUMBER_VAL(-1);
+}
+
+// Note(Kevin): buf.* works on whole buffers in native loops so a script updating thousands of particles
+//              doesn't go through the interpreter for every element. Natives in PipAPI read buffer data
+//              directly too, e.g. gfx.spritebatch and gfx.sprites.
+static HashMap Builtin_buf;
+
+#define BUFFER_MAX_COUNT (1 << 26)
+
+static TValue NewBufferFromArgs(int argc, TValue *argv, PipBuffer::ElementType elementType, const char *name)
+{
+    double n = argc == 1 && IS_NUMBER(argv[0]) ? AS_NUMBER(argv[0]) : -1.0;
+    if (!(n >= 0.0 && n <= (double)BUFFER_MAX_COUNT) || (double)(int)n != n)
+    {
+        PipLangVM_NativeRuntimeError("%s expects a whole number of elements up to %d.", name, BUFFER_MAX_COUNT);
+        return BOOL_VAL(false);
+    }
+    return RCOBJ_VAL((RCObject*)NewBuffer(elementType, (int)n));
+}
+
+// buf.f32(n), buf.i32(n), buf.u8(n): n zeroes
+static TValue Builtin_buf_f32(int argc, TValue *argv)
+{
+    return NewBufferFromArgs(argc, argv, PipBuffer::F32, "buf.f32");
+}
+
+static TValue Builtin_buf_i32(int argc, TValue *argv)
+{
+    return NewBufferFromArgs(argc, argv, PipBuffer::I32, "buf.i32");
+}
+
+static TValue Builtin_buf_u8(int argc, TValue *argv)
+{
+    return NewBufferFromArgs(argc, argv, PipBuffer::U8, "buf.u8");
+}
+
+// buf.fill(b, v)
+static TValue Builtin_buf_fill(int argc, TValue *argv)
+{
+    if (argc != 2 || !RCOBJ_IS_BUFFER(argv[0]) || !IS_NUMBER(argv[1]))
+    {
+        PipLangVM_NativeRuntimeError("buf.fill expects a buffer and a number.");
+        return BOOL_VAL(false);
+    }
+    BufferFill(RCOBJ_AS_BUFFER(argv[0]), AS_NUMBER(argv[1]));
+    return BOOL_VAL(true);
+}
+
+// buf.addscaled(dst, src, s): dst[i] = dst[i] + src[i] * s, e.g. buf.addscaled(xs, vxs, time.dt)
+static TValue Builtin_buf_addscaled(int argc, TValue *argv)
+{
+    if (argc != 3 || !RCOBJ_IS_BUFFER(argv[0]) || !RCOBJ_IS_BUFFER(argv[1]) || !IS_NUMBER(argv[2]))
+    {
+        PipLangVM_NativeRuntimeError("buf.addscaled expects two buffers and a number.");
+        return BOOL_VAL(false);
+    }
+    if (RCOBJ_AS_BUFFER(argv[0])->count != RCOBJ_AS_BUFFER(argv[1])->count)
+    {
+        PipLangVM_NativeRuntimeError("buf.addscaled expects buffers of the same length.");
+        return BOOL_VAL(false);
+    }
+    BufferAddScaled(RCOBJ_AS_BUFFER(argv[0]), RCOBJ_AS_BUFFER(argv[1]), AS_NUMBER(argv[2]));
+    return BOOL_VAL(true);
+}
+
+// buf.clamp(b, lo, hi)
+static TValue Builtin_buf_clamp(int argc, TValue *argv)
+{
+    if (argc != 3 || !RCOBJ_IS_BUFFER(argv[0]) || !IS_NUMBER(argv[1]) || !IS_NUMBER(argv[2]))
+    {
+        PipLangVM_NativeRuntimeError("buf.clamp expects a buffer and two numbers.");
+        return BOOL_VAL(false);
+    }
+    BufferClamp(RCOBJ_AS_BUFFER(argv[0]), AS_NUMBER(argv[1]), AS_NUMBER(argv[2]));
+    return BOOL_VAL(true);
+}
+
+// An f32 buffer of count elements (any count if count < 0), otherwise NULL
+static PipBuffer *F32BufferArg(TValue v, int count)
+{
+    if (!RCOBJ_IS_BUFFER(v)) return NULL;
+    PipBuffer *buffer = RCOBJ_AS_BUFFER(v);
+    if (buffer->elementType != PipBuffer::F32 || (count >= 0 && buffer->count != count)) return NULL;
+    return buffer;
+}
+
+// buf.sin(dst, src), buf.cos(dst, src), buf.sqrt(dst, src). dst can be src.
+static TValue BufferMathUnary(int argc, TValue *argv, BufferMathOp op, const char *name)
+{
+    PipBuffer *dst = argc == 2 ? F32BufferArg(argv[0], -1) : NULL;
+    PipBuffer *src = dst ? F32BufferArg(argv[1], dst->count) : NULL;
+    if (src == NULL)
+    {
+        PipLangVM_NativeRuntimeError("%s expects two f32 buffers of the same length.", name);
+        return BOOL_VAL(false);
+    }
+    BufferMathF32(op, (float*)dst->data, (const float*)src->data, NULL, 0.f, 0.f, dst->count);
+    return BOOL_VAL(true);
+}
+
+// buf.min(dst, a, b), buf.max(dst, a, b), buf.lerp(dst, a, b, t). b is an f32 buffer or a number.
+static TValue BufferMathBinary(int argc, TValue *argv, BufferMathOp op, const char *name)
+{
+    int expectedArgc = op == BufferMathOp::LERP ? 4 : 3;
+    PipBuffer *dst = argc == expectedArgc ? F32BufferArg(argv[0], -1) : NULL;
+    PipBuffer *a = dst ? F32BufferArg(argv[1], dst->count) : NULL;
+    PipBuffer *b = a ? F32BufferArg(argv[2], dst->count) : NULL;
+    bool bIsNumber = a && b == NULL && IS_NUMBER(argv[2]);
+    if (a == NULL || (b == NULL && !bIsNumber) || (op == BufferMathOp::LERP && !IS_NUMBER(argv[3])))
+    {
+        PipLangVM_NativeRuntimeError(op == BufferMathOp::LERP
+            ? "%s expects f32 buffers dst and a of the same length, a buffer or number b and a number t."
+            : "%s expects f32 buffers dst and a of the same length and a buffer or number b.", name);
+        return BOOL_VAL(false);
+    }
+    float s = bIsNumber ? (float)AS_NUMBER(argv[2]) : 0.f;
+    float t = op == BufferMathOp::LERP ? (float)AS_NUMBER(argv[3]) : 0.f;
+    BufferMathF32(op, (float*)dst->data, (const float*)a->data, b ? (const float*)b->data : NULL, s, t, dst->count);
+    return BOOL_VAL(true);
+}
+
+static TValue Builtin_buf_sin(int argc, TValue *argv)
+{
+    return BufferMathUnary(argc, argv, BufferMathOp::SIN, "buf.sin");
+}
+
+static TValue Builtin_buf_cos(int argc, TValue *argv)
+{
+    return BufferMathUnary(argc, argv, BufferMathOp::COS, "buf.cos");
+}
+
+static TValue Builtin_buf_sqrt(int argc, TValue *argv)
+{
+    return BufferMathUnary(argc, argv, BufferMathOp::SQRT, "buf.sqrt");
+}
+
+static TValue Builtin_buf_lerp(int argc, TValue *argv)
+{
+    return BufferMathBinary(argc, argv, BufferMathOp::LERP, "buf.lerp");
+}
+
+static TValue Builtin_buf_min(int argc, TValue *argv)
+{
+    return BufferMathBinary(argc, argv, BufferMathOp::MIN, "buf.min");
+}
+
+static TValue Builtin_buf_max(int argc, TValue *argv)
+{
+    return BufferMathBinary(argc, argv, BufferMathOp::MAX, "buf.max");
+}
+
 void PipLangVM_InitVM()
 {
     pipunitTestEnvironmentEnabled = false;
@@ -603,6 +1514,28 @@ void PipLangVM_InitVM()
     Stack_Reset();
     AllocateHashMap(&vm.interned_strings);
     AllocateHashMap(&vm.globals);
+
+    PipLangVM_DefineNativeFn(&vm.globals, "len", Builtin_len);
+
+    Builtin_buf = HashMap();
+    AllocateHashMap(&Builtin_buf);
+    ++Builtin_buf.base.refCount;
+    HashMapSet(&vm.globals, CopyString("buf", 3, true), RCOBJ_VAL((RCObject*)&Builtin_buf), NULL);
+    PipLangVM_DefineNativeFn(&Builtin_buf, "f32", Builtin_buf_f32);
+    PipLangVM_DefineNativeFn(&Builtin_buf, "i32", Builtin_buf_i32);
+    PipLangVM_DefineNativeFn(&Builtin_buf, "u8", Builtin_buf_u8);
+    PipLangVM_DefineNativeFn(&Builtin_buf, "fill", Builtin_buf_fill);
+    PipLangVM_DefineNativeFn(&Builtin_buf, "addscaled", Builtin_buf_addscaled);
+    PipLangVM_DefineNativeFn(&Builtin_buf, "clamp", Builtin_buf_clamp);
+    PipLangVM_DefineNativeFn(&Builtin_buf, "sin", Builtin_buf_sin);
+    PipLangVM_DefineNativeFn(&Builtin_buf, "cos", Builtin_buf_cos);
+    PipLangVM_DefineNativeFn(&Builtin_buf, "sqrt", Builtin_buf_sqrt);
+    PipLangVM_DefineNativeFn(&Builtin_buf, "lerp", Builtin_buf_lerp);
+    PipLangVM_DefineNativeFn(&Builtin_buf, "min", Builtin_buf_min);
+    PipLangVM_DefineNativeFn(&Builtin_buf, "max", Builtin_buf_max);
+    const char *backend = BufferMathBackendName();
+    HashMapSet(&Builtin_buf, CopyString("backend", 7, true),
+               RCOBJ_VAL((RCObject*)CopyString(backend, (int)strlen(backend), true)), NULL);
 }
 
 void PipLangVM_FreeVM()
@@ -639,10 +1572,39 @@ InterpretResult PipLangVM_RunGameFunction(const std::string& name)
     Stack_Push(fnv);
     PushCallFrame(fn, 0);
 
+#ifdef PIPLANG_FRAME_ARENA
+    BeginFrameArena();
+#endif
     InterpretResult result = Run();
+#ifdef PIPLANG_DEFERRED_RC
+    ReconcileZeroCountTable(vm.sp);
+#endif
+#ifdef PIPLANG_FRAME_ARENA
+    EndFrameArena(vm.stack, vm.sp);
+#endif
     return result;
 }
 
+#define CYCLE_ROOTS_PER_BATCH 1024
+
+void PipLangVM_CollectCycles(float budgetMilliseconds)
+{
+    double start = Time.TimeSinceProgramStartInSeconds();
+#ifdef PIPLANG_DEFERRED_RC
+    // Trial deletion only sees counted references. Count the stack's for the duration so nothing it holds
+    // looks like garbage, and empty the zero count table first so the collector can't free anything in it.
+    ReconcileZeroCountTable(vm.sp);
+    PinStackRefs(vm.sp);
+#endif
+    while (CollectCycles(CYCLE_ROOTS_PER_BATCH) > 0)
+    {
+        if ((Time.TimeSinceProgramStartInSeconds() - start) * 1000.0 >= budgetMilliseconds) break;
+    }
+#ifdef PIPLANG_DEFERRED_RC
+    UnpinStackRefs(vm.sp);
+#endif
+}
+
 InterpretResult PipLangVM_RunGameCode(const char *source)
 {
     return Interpret(source);
@@ -693,7 +1655,7 @@ static TValue PipUnit_checkeq(int argc, TValue *argv)
                 return {};
             }
 
-            printf("CHECKEQ FAIL: '%s'\n", RCOBJ_AS_STRING(message)->text.c_str());
+            printf("CHECKEQ FAIL: '%.*s'\n", (int)RCOBJ_AS_STRING(message)->length, RCStringChars(RCOBJ_AS_STRING(message)));
         }
         else
         {
@@ -728,7 +1690,7 @@ static TValue PipUnit_checkerror(int argc, TValue *argv)
     }
 
     bool stringmatch = true;
-    std::string expected = RCOBJ_AS_STRING(message)->text;
+    std::string expected(RCStringChars(RCOBJ_AS_STRING(message)), RCOBJ_AS_STRING(message)->length);
     if (strlen(expected.c_str()) <= strlen(lastRuntimeErrorMessage))
     {
         for (int i = 0; i < expected.length(); ++i)
@@ -776,7 +1738,52 @@ static TValue PipUnit_getrefcount(int argc, TValue *argv)
         return NUMBER_VAL(-1);
     }
 
+#ifdef PIPLANG_DEFERRED_RC
+    // Free what's waiting in the zero count table and count the locals and arguments holding obj, so the
+    // result is the same as with eager counting. argv[0] itself doesn't count, like any native argument.
+    ReconcileZeroCountTable(vm.sp);
+    i32 refCount = AS_RCOBJ(obj)->refCount;
+    for (TValue *v = vm.stack; v < argv; ++v)
+    {
+        if (IS_RCOBJ(*v) && AS_RCOBJ(*v) == AS_RCOBJ(obj)) ++refCount;
+    }
+    return NUMBER_VAL(refCount);
+#else
     return NUMBER_VAL(AS_RCOBJ(obj)->refCount);
+#endif
+}
+
+// Bytecode length of a script function, for tests on what the compiler emits
+static TValue PipUnit_getcodesize(int argc, TValue *argv)
+{
+    if (argc != 1 || !IS_FUNCTION(argv[0]))
+    {
+        PipLangVM_NativeRuntimeError("getcodesize expects a function as its argument.");
+        return NUMBER_VAL(-1);
+    }
+    return NUMBER_VAL((double)AS_FUNCTION(argv[0])->chunk.codeSize);
+}
+
+// Live strings once whatever is waiting in the zero count table is freed, for tests on temporaries that leak
+static TValue PipUnit_getlivestrings(int argc, TValue *argv)
+{
+#ifdef PIPLANG_DEFERRED_RC
+    ReconcileZeroCountTable(vm.sp);
+#endif
+    return NUMBER_VAL((double)GetPipObjectPoolStats().liveStrings);
+}
+
+// runticks(n): once the script body is done, call its tick function n times like the game loop does,
+// so tests can cover state that has to survive from one frame to the next
+static TValue PipUnit_runticks(int argc, TValue *argv)
+{
+    if (argc != 1 || !IS_NUMBER(argv[0]))
+    {
+        PipLangVM_NativeRuntimeError("runticks expects the number of ticks to run.");
+        return {};
+    }
+    pipunitTicksToRun = (int)AS_NUMBER(argv[0]);
+    return {};
 }
 
 static TValue PipUnit_enablepipunittests(int argc, TValue *argv)
@@ -785,9 +1792,13 @@ static TValue PipUnit_enablepipunittests(int argc, TValue *argv)
     pipUnitTestsRan = 0;
     pipunitTestsPassed = 0;
     pipunitTestsFailed = 0;
+    pipunitTicksToRun = 0;
     PipLangVM_DefineNativeFn(&vm.globals, "checkeq", PipUnit_checkeq);
     PipLangVM_DefineNativeFn(&vm.globals, "checkerror", PipUnit_checkerror);
     PipLangVM_DefineNativeFn(&vm.globals, "getrefcount", PipUnit_getrefcount);
+    PipLangVM_DefineNativeFn(&vm.globals, "getcodesize", PipUnit_getcodesize);
+    PipLangVM_DefineNativeFn(&vm.globals, "getlivestrings", PipUnit_getlivestrings);
+    PipLangVM_DefineNativeFn(&vm.globals, "runticks", PipUnit_runticks);
     return {};
 }
 
@@ -799,7 +1810,7 @@ static TValue PrintGlobals(int argc, TValue *argv)
     {
         if (vm.globals.entries[i].key)
         {
-            printf("    %-16s", vm.globals.entries[i].key->text.c_str());
+            printf("    %-16s", vm.globals.entries[i].key->chars);
             PrintTValue(vm.globals.entries[i].value);
             printf("\n");
         }
@@ -809,17 +1820,70 @@ static TValue PrintGlobals(int argc, TValue *argv)
     return BOOL_VAL(false);
 }
 
+static TValue PrintPoolStats(int argc, TValue *argv)
+{
+    PipObjectPoolStats stats = GetPipObjectPoolStats();
+    printf("======================\nPrinting OBJECT POOLS\n");
+    printf("    strings        live %-8zu peak %zu\n", stats.liveStrings, stats.peakStrings);
+    printf("    maps           live %-8zu peak %zu\n", stats.liveMaps, stats.peakMaps);
+    printf("    arrays         live %-8zu peak %zu\n", stats.liveArrays, stats.peakArrays);
+    printf("    buffers        live %-8zu peak %zu\n", stats.liveBuffers, stats.peakBuffers);
+    printf("    entry arrays   live %-8zu peak %zu\n", stats.liveEntryArrays, stats.peakEntryArrays);
+    printf("    slab bytes     %zu\n", stats.slabBytes);
+    printf("    frame arena    peak bytes %zu, last frame %zu objects, %zu promoted\n",
+           stats.frameArenaPeakBytes, stats.lastFrameArenaObjects, stats.lastFramePromotedObjects);
+    PipCycleCollectorStats cycles = GetPipCycleCollectorStats();
+    printf("    cycle roots    %zu buffered\n", cycles.bufferedRoots);
+    printf("    cycles         %zu collections, %zu scanned, %zu freed\n",
+           cycles.collections, cycles.totalScanned, cycles.totalFreed);
+#ifdef PIPLANG_DEFERRED_RC
+    printf("    zero count     %zu waiting, %zu reconciles, %zu freed\n",
+           zeroCountTable.size(), zeroCountReconciles, zeroCountFreed);
+#endif
+    printf("======================\n");
+
+    return BOOL_VAL(false);
+}
+
+// Runs the cycle collector over every candidate root, returns how many maps it freed
+static TValue CollectCyclesNative(int argc, TValue *argv)
+{
+    size_t freed = 0;
+#ifdef PIPLANG_DEFERRED_RC
+    ReconcileZeroCountTable(vm.sp);
+    PinStackRefs(vm.sp);
+#endif
+    do
+    {
+        CollectCycles(CYCLE_ROOTS_PER_BATCH);
+        freed += GetPipCycleCollectorStats().lastFreed;
+    } while (GetPipCycleCollectorStats().bufferedRoots > 0);
+#ifdef PIPLANG_DEFERRED_RC
+    UnpinStackRefs(vm.sp);
+#endif
+    return NUMBER_VAL((double)freed);
+}
+
 InterpretResult PipLangVM_RunScript(const char *source)
 {
     PipLangVM_DefineNativeFn(&vm.globals, "printglobals", PrintGlobals);
+    PipLangVM_DefineNativeFn(&vm.globals, "printpoolstats", PrintPoolStats);
+    PipLangVM_DefineNativeFn(&vm.globals, "collectcycles", CollectCyclesNative);
     PipLangVM_DefineNativeFn(&vm.globals, "enablepipunit", PipUnit_enablepipunittests);
 
     double t = Time.TimeSinceProgramStartInSeconds();
     InterpretResult result = Interpret(source);
+    for (int i = 0; i < pipunitTicksToRun && result == InterpretResult::OK; ++i)
+    {
+        result = PipLangVM_RunGameFunction("tick");
+        PipLangVM_CollectCycles(0.5f);
+    }
+    pipunitTicksToRun = 0;
     printf("compile and vm took %lf\n", Time.TimeSinceProgramStartInSeconds() - t);
 
     if (pipunitTestEnvironmentEnabled)
     {
+        PipUnit_FailUncheckedRuntimeError();
         printf("pipunit ran %4d tests\n", pipUnitTestsRan);
         printf("pipunit passed %4d tests\n", pipunitTestsPassed);
         printf("pipunit failed %4d tests\n", pipunitTestsFailed);
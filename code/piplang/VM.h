@@ -20,6 +20,7 @@ struct CallFrame
     PipFunction *fn;
     u8 *ip;     // instruction pointer
     TValue *bp; // base pointer
+    TValue *kp; // fn's sealed constant table
 };
 
 struct VM
@@ -42,6 +43,8 @@ void PipLangVM_DefineNativeFn(HashMap *mapToAddTo, const char *name, NativeFn fn
 void PipLangVM_NativeRuntimeError(const char *format, ...);
 InterpretResult PipLangVM_RunGameCode(const char *source);
 InterpretResult PipLangVM_RunGameFunction(const std::string& name);
+// Frees garbage map cycles, stops starting new batches of candidate roots once the budget is used up
+void PipLangVM_CollectCycles(float budgetMilliseconds);
 
 
 InterpretResult PipLangVM_RunScript(const char *source);